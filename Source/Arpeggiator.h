@@ -0,0 +1,379 @@
+/*
+  ==============================================================================
+
+    Arpeggiator.h
+
+    Sample-accurate arpeggiator that sits between the incoming MIDI and the
+    synth. All state is fixed-size and the output buffer is reserved up front,
+    so process() never allocates on the audio thread.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <bitset>
+
+//==============================================================================
+class Arpeggiator
+{
+public:
+    enum class Mode
+    {
+        up = 1,
+        down,
+        upDown,
+        asPlayed
+    };
+
+    /** Steps per quarter note. */
+    enum class Rate
+    {
+        quarter      = 1,
+        eighth       = 2,
+        sixteenth    = 4,
+        thirtySecond = 8,
+        sixtyFourth  = 16
+    };
+
+    static constexpr double minimumTempo = 20.0, maximumTempo = 999.0;
+
+    Arpeggiator() = default;
+
+    //==============================================================================
+    void setEnabled (bool shouldBeEnabled) noexcept    { enabled = shouldBeEnabled; }
+    bool isEnabled() const noexcept                    { return enabled; }
+
+    /** True when process() would neither play nor release anything on its own.
+        Audio thread only.
+    */
+    bool isIdle() const noexcept                       { return playingNote < 0 && (numHeld == 0 || ! enabled); }
+
+    void setTempo (double bpm) noexcept                { tempo = juce::jlimit (minimumTempo, maximumTempo, bpm); }
+    void setRate (Rate newRate) noexcept               { rate = newRate; }
+    void setMode (Mode newMode) noexcept               { mode = newMode; }
+
+    /** Fraction of each step for which the generated note is held, 0.05 to 1. */
+    void setGate (float newGate) noexcept              { gate = juce::jlimit (0.05f, 1.0f, newGate); }
+
+    //==============================================================================
+    /** Reserves the output buffer for the worst case at this sample rate: the
+        fastest rate at the highest tempo over maximumBlockSize samples, plus
+        passThroughBytes of incoming events, which should match what the
+        incoming buffer is sized for. Controllers and other events beyond that,
+        and steps in a block longer than maximumBlockSize, are dropped and
+        counted rather than grow the buffer on the audio thread.
+    */
+    void prepare (double newSampleRate, int maximumBlockSize, size_t passThroughBytes)
+    {
+        sampleRate = newSampleRate;
+        preparedBlockSize = maximumBlockSize;
+
+        auto shortestStep = sampleRate * 60.0 / maximumTempo / (double) Rate::sixtyFourth;
+        maxStepsPerBlock = (int) std::ceil (maximumBlockSize / juce::jmax (1.0, shortestStep)) + 1;
+
+        // every step's note-on can bring a note-off, plus one for the note carried in
+        maxPassThroughBytes = passThroughBytes;
+        generated.ensureSize ((size_t) (2 * maxStepsPerBlock + 1) * bytesPerEvent + maxPassThroughBytes);
+        reset();
+    }
+
+    /** Bytes the output buffer has allocated, which prepare() reserves. */
+    size_t getMemoryUsage() const noexcept             { return (size_t) generated.data.getNumAllocated(); }
+
+    /** Events dropped because the pass-through space or the step budget was full; any thread. */
+    juce::int64 getNumDroppedEvents() const noexcept   { return droppedEvents.load(); }
+
+    void reset() noexcept
+    {
+        numHeld = 0;
+        stepIndex = 0;
+        playingNote = -1;
+        samplesToNextStep = 0.0;
+        samplesToNoteOff = 0.0;
+        generated.clear();
+
+        for (auto& notes : passedThrough)
+            notes.reset();
+    }
+
+    //==============================================================================
+    /** Replaces the note events in [startSample, startSample + numSamples) of the
+        buffer with arpeggiated ones. Everything other than note on/off passes
+        through unchanged, and held keys are tracked even while disabled so that
+        switching on mid-chord picks them up straight away. Notes the synth was
+        sent directly while disabled still get their note-offs once enabled,
+        so they can't stick.
+    */
+    void process (juce::MidiBuffer& midi, int startSample, int numSamples)
+    {
+        if (numSamples <= 0)
+            return;
+
+        // a longer block would need more steps than prepare() reserved for
+        jassert (numSamples <= preparedBlockSize);
+
+        auto isActive = enabled.load();
+
+        if (! isActive && playingNote < 0)
+        {
+            for (const auto metadata : midi)
+            {
+                auto message = metadata.getMessage();
+                trackHeldNote (message);
+                trackPassedThrough (message);
+            }
+
+            return;
+        }
+
+        generated.clear();
+        auto passThroughBytesLeft = maxPassThroughBytes;
+        stepsLeft = maxStepsPerBlock;
+
+        auto stepLength = sampleRate * 60.0 / tempo.load() / (double) rate.load();
+        auto blockPosition = 0;
+
+        for (const auto metadata : midi)
+        {
+            auto message = metadata.getMessage();
+            auto position = juce::jlimit (0, numSamples - 1, metadata.samplePosition - startSample);
+
+            auto eventBytes = eventHeaderBytes + (size_t) metadata.numBytes;
+
+            if (! message.isNoteOnOrOff())
+            {
+                if (eventBytes > passThroughBytesLeft)
+                {
+                    droppedEvents.fetch_add (1, std::memory_order_relaxed);
+                    continue;
+                }
+
+                passThroughBytesLeft -= eventBytes;
+                generated.addEvent (message, metadata.samplePosition);
+                trackPassedThrough (message);
+                continue;
+            }
+
+            advance (blockPosition, position, startSample, stepLength, isActive);
+            blockPosition = position;
+
+            auto wasEmpty = (numHeld == 0);
+            trackHeldNote (message);
+
+            // note events always pass when they must, or a note would stick
+            if (! isActive || (message.isNoteOff() && wasPassedThrough (message)))
+            {
+                passThroughBytesLeft -= juce::jmin (passThroughBytesLeft, eventBytes);
+                generated.addEvent (message, metadata.samplePosition);
+                trackPassedThrough (message);
+            }
+
+            if (wasEmpty && numHeld > 0)
+            {
+                stepIndex = 0;
+                samplesToNextStep = 0.0;
+            }
+        }
+
+        advance (blockPosition, numSamples, startSample, stepLength, isActive);
+
+        samplesToNextStep -= numSamples;
+        samplesToNoteOff  -= numSamples;
+
+        midi.swapWith (generated);
+    }
+
+private:
+    struct HeldNote
+    {
+        int channel, note, velocity;
+    };
+
+    static constexpr size_t bytesPerEvent = 16;
+
+    /** What MidiBuffer stores ahead of each event's bytes: position and size. */
+    static constexpr size_t eventHeaderBytes = sizeof (juce::int32) + sizeof (juce::uint16);
+
+    //==============================================================================
+    /** Emits every step and note-off that falls in [from, to) of the block.
+        samplesToNextStep and samplesToNoteOff are measured from the block start.
+    */
+    void advance (int from, int to, int startSample, double stepLength, bool isActive)
+    {
+        if (! isActive)
+        {
+            if (playingNote >= 0)
+                releasePlayingNote (startSample + from);
+
+            return;
+        }
+
+        for (;;)
+        {
+            auto nextOff  = playingNote >= 0 ? samplesToNoteOff : std::numeric_limits<double>::max();
+            auto nextStep = numHeld > 0 ? juce::jmax ((double) from, samplesToNextStep)
+                                        : std::numeric_limits<double>::max();
+
+            if (juce::jmin (nextOff, nextStep) >= (double) to)
+                break;
+
+            if (nextOff <= nextStep)
+            {
+                releasePlayingNote (startSample + juce::jmax (from, (int) nextOff));
+                continue;
+            }
+
+            auto position = (int) nextStep;
+
+            if (playingNote >= 0)
+                releasePlayingNote (startSample + position);
+
+            samplesToNextStep = nextStep + stepLength;
+
+            if (stepsLeft <= 0)
+            {
+                droppedEvents.fetch_add (1, std::memory_order_relaxed);
+                continue;
+            }
+
+            --stepsLeft;
+
+            const auto& step = pickNextNote();
+            generated.addEvent (juce::MidiMessage::noteOn (step.channel, step.note, (juce::uint8) step.velocity),
+                                startSample + position);
+
+            playingNote = step.note;
+            playingChannel = step.channel;
+            samplesToNoteOff = nextStep + juce::jmax (1.0, stepLength * gate.load());
+        }
+    }
+
+    void releasePlayingNote (int samplePosition)
+    {
+        generated.addEvent (juce::MidiMessage::noteOff (playingChannel, playingNote), samplePosition);
+        playingNote = -1;
+    }
+
+    const HeldNote& pickNextNote() noexcept
+    {
+        auto count = numHeld;
+        auto index = 0;
+
+        switch (mode.load())
+        {
+            case Mode::up:        index = stepIndex % count; break;
+            case Mode::down:      index = count - 1 - stepIndex % count; break;
+            case Mode::asPlayed:  index = stepIndex % count; break;
+
+            case Mode::upDown:
+            {
+                auto cycle = juce::jmax (1, 2 * count - 2);
+                auto i = stepIndex % cycle;
+                index = i < count ? i : cycle - i;
+                break;
+            }
+
+            default: break;
+        }
+
+        ++stepIndex;
+        return mode.load() == Mode::asPlayed ? heldInOrder[(size_t) index] : heldSorted[(size_t) index];
+    }
+
+    //==============================================================================
+    void trackHeldNote (const juce::MidiMessage& message) noexcept
+    {
+        if (message.isNoteOn())
+            addHeldNote ({ message.getChannel(), message.getNoteNumber(), (int) message.getVelocity() });
+        else if (message.isNoteOff())
+            removeHeldNote (message.getChannel(), message.getNoteNumber());
+        else if (message.isAllNotesOff() || message.isAllSoundOff())
+            numHeld = 0;
+    }
+
+    /** Remembers which notes reached the synth directly, so their note-offs can
+        follow them there.
+    */
+    void trackPassedThrough (const juce::MidiMessage& message) noexcept
+    {
+        auto& notes = passedThrough[(size_t) juce::jlimit (1, 16, message.getChannel()) - 1];
+
+        if (message.isNoteOn())
+            notes.set ((size_t) message.getNoteNumber());
+        else if (message.isNoteOff())
+            notes.reset ((size_t) message.getNoteNumber());
+        else if (message.isAllNotesOff() || message.isAllSoundOff())
+            notes.reset();
+    }
+
+    bool wasPassedThrough (const juce::MidiMessage& message) const noexcept
+    {
+        return passedThrough[(size_t) juce::jlimit (1, 16, message.getChannel()) - 1][(size_t) message.getNoteNumber()];
+    }
+
+    void addHeldNote (HeldNote held) noexcept
+    {
+        removeHeldNote (held.channel, held.note);
+
+        if (numHeld >= (int) heldInOrder.size())
+            return;
+
+        heldInOrder[(size_t) numHeld] = held;
+
+        auto i = numHeld;
+
+        while (i > 0 && heldSorted[(size_t) i - 1].note > held.note)
+        {
+            heldSorted[(size_t) i] = heldSorted[(size_t) i - 1];
+            --i;
+        }
+
+        heldSorted[(size_t) i] = held;
+        ++numHeld;
+    }
+
+    void removeHeldNote (int channel, int note) noexcept
+    {
+        auto remove = [this, channel, note] (std::array<HeldNote, 128>& list)
+        {
+            for (auto i = 0; i < numHeld; ++i)
+            {
+                if (list[(size_t) i].channel == channel && list[(size_t) i].note == note)
+                {
+                    std::copy (list.begin() + i + 1, list.begin() + numHeld, list.begin() + i);
+                    return true;
+                }
+            }
+
+            return false;
+        };
+
+        if (remove (heldInOrder) && remove (heldSorted))
+            --numHeld;
+    }
+
+    //==============================================================================
+    std::atomic<bool> enabled { false };
+    std::atomic<double> tempo { 120.0 };
+    std::atomic<Rate> rate { Rate::sixteenth };
+    std::atomic<Mode> mode { Mode::up };
+    std::atomic<float> gate { 0.5f };
+
+    double sampleRate = 44100.0;
+    double samplesToNextStep = 0.0, samplesToNoteOff = 0.0;
+
+    std::array<HeldNote, 128> heldInOrder, heldSorted;
+    int numHeld = 0, stepIndex = 0;
+    int playingNote = -1, playingChannel = 1;
+
+    std::array<std::bitset<128>, 16> passedThrough;
+
+    juce::MidiBuffer generated;
+    size_t maxPassThroughBytes = 0;
+    int preparedBlockSize = 0, maxStepsPerBlock = 0, stepsLeft = 0;
+    std::atomic<juce::int64> droppedEvents { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Arpeggiator)
+};
@@ -0,0 +1,92 @@
+/*
+  ==============================================================================
+
+    AudioSampleFifo.h
+
+    A single-producer, single-consumer FIFO of multichannel audio, for
+    handing blocks rendered ahead on a background thread to the audio
+    callback. The storage is allocated once in prepare(); push and pop only
+    copy into and out of it.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+class AudioSampleFifo
+{
+public:
+    AudioSampleFifo() = default;
+
+    /** Not real-time safe, and neither side may be using the FIFO meanwhile. */
+    void prepare (int numChannels, int numSamples)
+    {
+        // AbstractFifo keeps one slot empty to tell full from empty
+        fifo.setTotalSize (numSamples + 1);
+        buffer.setSize (numChannels, numSamples + 1);
+        fifo.reset();
+    }
+
+    /** Also only safe while neither side is using the FIFO. */
+    void reset() noexcept               { fifo.reset(); }
+
+    int getNumReady() const noexcept    { return fifo.getNumReady(); }
+    int getFreeSpace() const noexcept   { return fifo.getFreeSpace(); }
+
+    /** Producer side: copies the first numSamples of source in. Returns false,
+        copying nothing, if there isn't room for all of them.
+    */
+    bool push (const juce::AudioBuffer<float>& source, int numSamples) noexcept
+    {
+        if (fifo.getFreeSpace() < numSamples)
+            return false;
+
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite (numSamples, start1, size1, start2, size2);
+
+        for (auto channel = 0; channel < buffer.getNumChannels(); ++channel)
+        {
+            auto sourceChannel = juce::jmin (channel, source.getNumChannels() - 1);
+
+            buffer.copyFrom (channel, start1, source, sourceChannel, 0, size1);
+            buffer.copyFrom (channel, start2, source, sourceChannel, size1, size2);
+        }
+
+        fifo.finishedWrite (size1 + size2);
+        return true;
+    }
+
+    /** Consumer side: adds up to numSamples into dest at startSample and
+        returns how many there were.
+    */
+    int popAndAdd (juce::AudioBuffer<float>& dest, int startSample, int numSamples) noexcept
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead (juce::jmin (numSamples, fifo.getNumReady()), start1, size1, start2, size2);
+
+        for (auto channel = 0; channel < dest.getNumChannels(); ++channel)
+        {
+            auto sourceChannel = juce::jmin (channel, buffer.getNumChannels() - 1);
+
+            dest.addFrom (channel, startSample, buffer, sourceChannel, start1, size1);
+            dest.addFrom (channel, startSample + size1, buffer, sourceChannel, start2, size2);
+        }
+
+        fifo.finishedRead (size1 + size2);
+        return size1 + size2;
+    }
+
+    size_t getMemoryUsage() const noexcept
+    {
+        return (size_t) buffer.getNumChannels() * (size_t) buffer.getNumSamples() * sizeof (float);
+    }
+
+private:
+    juce::AbstractFifo fifo { 1 };
+    juce::AudioBuffer<float> buffer;
+
+    JUCE_DECLARE_NON_COPYABLE (AudioSampleFifo)
+};
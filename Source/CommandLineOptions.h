@@ -0,0 +1,55 @@
+/*
+  ==============================================================================
+
+    CommandLineOptions.h
+
+    Small helpers for the headless tools started from Main.cpp.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/** Returns the value of a "--name=value" argument, or fallback if it isn't there. */
+inline juce::String getCommandLineOption (const juce::StringArray& args, const juce::String& name,
+                                          const juce::String& fallback = {})
+{
+    for (auto& arg : args)
+        if (arg.startsWith (name + "="))
+            return arg.fromFirstOccurrenceOf ("=", false, false).unquoted();
+
+    return fallback;
+}
+
+inline double getCommandLineOption (const juce::StringArray& args, const juce::String& name, double fallback)
+{
+    auto value = getCommandLineOption (args, name);
+    return value.isNotEmpty() ? value.getDoubleValue() : fallback;
+}
+
+inline int getCommandLineOption (const juce::StringArray& args, const juce::String& name, int fallback)
+{
+    auto value = getCommandLineOption (args, name);
+    return value.isNotEmpty() ? value.getIntValue() : fallback;
+}
+
+/** A comma-separated list, such as "--notes=33,69,105". */
+inline std::vector<int> getCommandLineOption (const juce::StringArray& args, const juce::String& name,
+                                              const std::vector<int>& fallback)
+{
+    auto value = getCommandLineOption (args, name);
+
+    if (value.isEmpty())
+        return fallback;
+
+    std::vector<int> result;
+
+    for (auto& item : juce::StringArray::fromTokens (value, ",", {}))
+        if (item.trim().isNotEmpty())
+            result.push_back (item.getIntValue());
+
+    return result;
+}
@@ -0,0 +1,154 @@
+/*
+  ==============================================================================
+
+    EmbeddedWavetables.h
+
+    The built-in timbres' mipmap levels, evaluated by the compiler and kept in
+    the binary's read-only data. Startup does no table work, and every running
+    instance shares the same pages. MipmappedWavetable refers to them in place.
+
+    The sums match MipmappedWavetable's runtime build to within one rounding
+    of std::sin. Every harmonic reads from a single quarter-wave sine table,
+    so the only series evaluation is that table's 1025 points. The eight-
+    harmonic level still takes a few million constant-evaluation steps, more
+    than clang and MSVC allow by default, so the exporters raise their limits
+    (-fconstexpr-steps, /constexpr:steps). GCC's default is already enough.
+
+    With SYNTH_EMBED_WAVETABLES set to 0, only the recipes are compiled in
+    and SineWaveSound builds its levels at runtime, on demand.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#ifndef SYNTH_EMBED_WAVETABLES
+ #define SYNTH_EMBED_WAVETABLES 1
+#endif
+
+//==============================================================================
+namespace EmbeddedWavetables
+{
+    // 2^12 keeps linear-interpolation error below -100 dB while every level of
+    // both timbres fits in L2; see --benchmark-wavetables.
+    constexpr int tableSize = 1 << 12;
+
+    /** weights[i] is the amplitude of harmonic i + 1. */
+    struct Recipe
+    {
+        int numHarmonics;
+        float weights[8];
+    };
+
+    /** One cycle plus a guard sample equal to the first, as MipmappedWavetable
+        lays its levels out.
+    */
+    struct Level
+    {
+        int harmonics;
+        double sumOfSquares;
+        float samples[tableSize + 1];
+    };
+
+    struct Mipmaps
+    {
+        const Recipe* recipe;
+        const Level* const* levels;
+        int numLevels;
+    };
+
+    /** A rounded tone with only the first three harmonics. */
+    constexpr Recipe softRecipe { 3, { 1.0f, 0.25f, 0.11f } };
+
+    /** The original eight-harmonic 1/n sum. */
+    constexpr Recipe brightRecipe { 8, { 1.0f, 1.0f / 2, 1.0f / 3, 1.0f / 4, 1.0f / 5, 1.0f / 6, 1.0f / 7, 1.0f / 8 } };
+
+   #if SYNTH_EMBED_WAVETABLES
+    //==============================================================================
+    namespace detail
+    {
+        constexpr int quarter = tableSize / 4;
+
+        struct QuarterSine
+        {
+            double values[quarter + 1];
+        };
+
+        /** Taylor series; for |x| <= pi / 2 the first omitted term is below 1e-20. */
+        constexpr double sinSeries (double x)
+        {
+            double term = x, sum = x;
+
+            for (int n = 1; n < 15; ++n)
+            {
+                term *= -x * x / ((2 * n) * (2 * n + 1));
+                sum += term;
+            }
+
+            return sum;
+        }
+
+        constexpr QuarterSine makeQuarterSine()
+        {
+            QuarterSine q {};
+
+            for (int i = 0; i <= quarter; ++i)
+                q.values[i] = sinSeries (6.283185307179586476925286766559 * i / tableSize);
+
+            return q;
+        }
+
+        constexpr QuarterSine quarterSine = makeQuarterSine();
+
+        /** sin (2 pi index / tableSize) for index in [0, tableSize). */
+        constexpr double sineAt (int index)
+        {
+            return index <= quarter     ?  quarterSine.values[index]
+                 : index <= 2 * quarter ?  quarterSine.values[2 * quarter - index]
+                 : index <= 3 * quarter ? -quarterSine.values[index - 2 * quarter]
+                                        : -quarterSine.values[tableSize - index];
+        }
+
+        /** Same summation order and precision as MipmappedWavetable::fillLevel(). */
+        constexpr Level makeLevel (const Recipe& recipe, int harmonics)
+        {
+            Level level {};
+            level.harmonics = harmonics;
+
+            for (int i = 0; i < tableSize; ++i)
+            {
+                float sample = 0.0f;
+
+                for (int harmonic = 1; harmonic <= harmonics; ++harmonic)
+                    sample += recipe.weights[harmonic - 1] * (float) sineAt ((harmonic * i) % tableSize);
+
+                level.samples[i] = sample;
+            }
+
+            level.samples[tableSize] = level.samples[0];
+
+            for (int i = 0; i < tableSize; ++i)
+                level.sumOfSquares += level.samples[i] * level.samples[i];
+
+            return level;
+        }
+
+        // one variable per level, so each is a separate evaluation against the step limit
+        constexpr Level soft3 = makeLevel (softRecipe, 3);
+        constexpr Level soft1 = makeLevel (softRecipe, 1);
+        constexpr const Level* softLevels[] = { &soft3, &soft1 };
+
+        constexpr Level bright8 = makeLevel (brightRecipe, 8);
+        constexpr Level bright4 = makeLevel (brightRecipe, 4);
+        constexpr Level bright2 = makeLevel (brightRecipe, 2);
+        constexpr Level bright1 = makeLevel (brightRecipe, 1);
+        constexpr const Level* brightLevels[] = { &bright8, &bright4, &bright2, &bright1 };
+    }
+
+    //==============================================================================
+    constexpr Mipmaps soft   { &softRecipe,   detail::softLevels,   2 };
+    constexpr Mipmaps bright { &brightRecipe, detail::brightLevels, 4 };
+   #endif
+}
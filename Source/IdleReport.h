@@ -0,0 +1,106 @@
+/*
+  ==============================================================================
+
+    IdleReport.h
+
+    Measures what the audio callback costs while nothing is playing, with the
+    idle fast path off and then on. Run it with --idle-report [--seconds=N]
+    [--sample-rate=R] [--block-size=N]; see Main.cpp.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <ctime>
+#include <iostream>
+#include "CommandLineOptions.h"
+
+//==============================================================================
+class IdleReport
+{
+public:
+    struct Options
+    {
+        double seconds = 60.0;
+        double sampleRate = 48000.0;
+        int blockSize = 512;
+
+        static Options fromCommandLine (const juce::StringArray& args)
+        {
+            Options o;
+            o.seconds    = getCommandLineOption (args, "--seconds", o.seconds);
+            o.sampleRate = getCommandLineOption (args, "--sample-rate", o.sampleRate);
+            o.blockSize  = getCommandLineOption (args, "--block-size", o.blockSize);
+            return o;
+        }
+    };
+
+    explicit IdleReport (Options optionsToUse)  : options (std::move (optionsToUse)) {}
+
+    /** Renders the same stretch of silence both ways, unpaced, and prints the
+        cost per block and as a share of one CPU core in real time.
+    */
+    int run()
+    {
+        std::cout << "fast_path,blocks,ns_per_block,cpu_ns_per_block,idle_load_percent" << std::endl;
+
+        for (auto fastPath : { false, true })
+        {
+            auto result = measure (fastPath);
+            auto blockSeconds = options.blockSize / options.sampleRate;
+
+            std::cout << (fastPath ? "on" : "off") << ',' << result.numBlocks << ','
+                      << result.wallSeconds * 1.0e9 / result.numBlocks << ','
+                      << result.cpuSeconds * 1.0e9 / result.numBlocks << ','
+                      << 100.0 * result.cpuSeconds / (result.numBlocks * blockSeconds) << std::endl;
+        }
+
+        return 0;
+    }
+
+private:
+    struct Result
+    {
+        juce::int64 numBlocks;
+        double wallSeconds, cpuSeconds;
+    };
+
+    /** One note is played and left to die away first, so the voices, effects
+        and keyboard state are in the state a real idle period starts from.
+    */
+    Result measure (bool fastPath)
+    {
+        juce::MidiKeyboardState keyboardState;
+        SynthAudioSource source (keyboardState);
+        juce::AudioSampleBuffer buffer (SynthAudioSource::numOutputChannels, options.blockSize);
+
+        source.prepareToPlay (options.blockSize, options.sampleRate);
+        source.setIdleFastPathEnabled (fastPath);
+
+        auto& collector = *source.getMidiCollector();
+        auto now = juce::Time::getMillisecondCounterHiRes() * 0.001;
+        collector.addMessageToQueue (juce::MidiMessage::noteOn (1, 60, (juce::uint8) 100).withTimeStamp (now));
+        source.getNextAudioBlock (juce::AudioSourceChannelInfo (buffer));
+        collector.addMessageToQueue (juce::MidiMessage::noteOff (1, 60).withTimeStamp (now));
+
+        for (auto i = 0; i < (int) options.sampleRate / options.blockSize + 1; ++i)
+            source.getNextAudioBlock (juce::AudioSourceChannelInfo (buffer));
+
+        auto numBlocks = juce::jmax ((juce::int64) 1, (juce::int64) (options.seconds * options.sampleRate) / options.blockSize);
+
+        auto startClock = std::clock();
+        auto startTicks = juce::Time::getHighResolutionTicks();
+
+        for (juce::int64 block = 0; block < numBlocks; ++block)
+            source.getNextAudioBlock (juce::AudioSourceChannelInfo (buffer));
+
+        auto wallSeconds = juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks() - startTicks);
+        auto cpuSeconds = (double) (std::clock() - startClock) / CLOCKS_PER_SEC;
+
+        return { numBlocks, wallSeconds, cpuSeconds };
+    }
+
+    Options options;
+};
@@ -1,68 +1,206 @@
-/*
-  ==============================================================================
-
-    This file contains the startup code for a PIP.
-
-  ==============================================================================
-*/
-
-#include <JuceHeader.h>
-#include "SynthUsingMidiInputTutorial_01.h"
-
-class Application    : public juce::JUCEApplication
-{
-public:
-    //==============================================================================
-    Application() = default;
-
-    const juce::String getApplicationName() override       { return "SynthUsingMidiInputTutorial"; }
-    const juce::String getApplicationVersion() override    { return "1.0.0"; }
-
-    void initialise (const juce::String&) override
-    {
-        mainWindow.reset (new MainWindow ("SynthUsingMidiInputTutorial", new MainContentComponent, *this));
-    }
-
-    void shutdown() override                         { mainWindow = nullptr; }
-
-private:
-    class MainWindow    : public juce::DocumentWindow
-    {
-    public:
-        MainWindow (const juce::String& name, juce::Component* c, JUCEApplication& a)
-            : DocumentWindow (name, juce::Desktop::getInstance().getDefaultLookAndFeel()
-                                                                .findColour (ResizableWindow::backgroundColourId),
-                              juce::DocumentWindow::allButtons),
-              app (a)
-        {
-            setUsingNativeTitleBar (true);
-            setContentOwned (c, true);
-
-           #if JUCE_ANDROID || JUCE_IOS
-            setFullScreen (true);
-           #else
-            setResizable (true, false);
-            setResizeLimits (300, 250, 10000, 10000);
-            centreWithSize (getWidth(), getHeight());
-           #endif
-
-            setVisible (true);
-        }
-
-        void closeButtonPressed() override
-        {
-            app.systemRequestedQuit();
-        }
-
-    private:
-        JUCEApplication& app;
-
-        //==============================================================================
-        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MainWindow)
-    };
-
-    std::unique_ptr<MainWindow> mainWindow;
-};
-
-//==============================================================================
-START_JUCE_APPLICATION (Application)
+/*
+  ==============================================================================
+
+    This file contains the startup code for a PIP.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "SynthUsingMidiInputTutorial_01.h"
+#include "WavetableBenchmark.h"
+#include "OscillatorBenchmark.h"
+#include "SineBenchmark.h"
+#include "MidiFloodTest.h"
+#include "SessionReplay.h"
+#include "MemoryReport.h"
+#include "SoakTest.h"
+#include "IdleReport.h"
+#include "StartupProfile.h"
+
+// starts the --profile-startup clock before JUCE initialises
+static auto& startupProfile = StartupProfile::getInstance();
+
+#if SYNTH_COUNT_ALLOCATIONS
+//==============================================================================
+// Counts the heap allocations made inside a ProcessMemory::ScopedCount, on
+// that thread only, for --soak. Must only be defined in one translation unit.
+// The C++17 aligned overloads are left to the library, so over-aligned
+// allocations go uncounted but stay paired with its own aligned delete.
+void* operator new (std::size_t size)
+{
+    ProcessMemory::countAllocation();
+
+    if (auto* p = std::malloc (size == 0 ? 1 : size))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void* operator new (std::size_t size, const std::nothrow_t&) noexcept
+{
+    ProcessMemory::countAllocation();
+    return std::malloc (size == 0 ? 1 : size);
+}
+
+void* operator new[] (std::size_t size)                 { return operator new (size); }
+void* operator new[] (std::size_t size, const std::nothrow_t& tag) noexcept  { return operator new (size, tag); }
+void operator delete (void* p) noexcept                 { std::free (p); }
+void operator delete[] (void* p) noexcept               { std::free (p); }
+void operator delete (void* p, std::size_t) noexcept    { std::free (p); }
+void operator delete[] (void* p, std::size_t) noexcept  { std::free (p); }
+void operator delete (void* p, const std::nothrow_t&) noexcept    { std::free (p); }
+void operator delete[] (void* p, const std::nothrow_t&) noexcept  { std::free (p); }
+#endif
+
+class Application    : public juce::JUCEApplication
+{
+public:
+    //==============================================================================
+    Application() = default;
+
+    const juce::String getApplicationName() override       { return "SynthUsingMidiInputTutorial"; }
+    const juce::String getApplicationVersion() override    { return "1.0.0"; }
+
+    void initialise (const juce::String& commandLine) override
+    {
+        auto args = juce::StringArray::fromTokens (commandLine, true);
+
+        startupProfile.setEnabled (args.contains ("--profile-startup"));
+        startupProfile.mark ("JUCE initialisation");
+
+        if (args.contains ("--benchmark-wavetables"))
+        {
+            runHeadless ([args] { return WavetableBenchmark (WavetableBenchmark::Options::fromCommandLine (args)).run(); });
+            return;
+        }
+
+        if (args.contains ("--benchmark-oscillators"))
+        {
+            runHeadless ([args] { return OscillatorBenchmark (OscillatorBenchmark::Options::fromCommandLine (args)).run(); });
+            return;
+        }
+
+        if (args.contains ("--benchmark-sine"))
+        {
+            runHeadless ([args] { return SineBenchmark (SineBenchmark::Options::fromCommandLine (args)).run(); });
+            return;
+        }
+
+        if (args.contains ("--midi-flood"))
+        {
+            runHeadless ([args] { return MidiFloodTest (MidiFloodTest::Options::fromCommandLine (args)).run(); });
+            return;
+        }
+
+        if (args.contains ("--memory-report"))
+        {
+            runHeadless ([args] { return MemoryReport (getCommandLineOption (args, "--notes", 100000),
+                                                       getCommandLineOption (args, "--wavetable-budget", 0)).run(); });
+            return;
+        }
+
+        if (args.contains ("--soak"))
+        {
+            runHeadless ([args] { return SoakTest (SoakTest::Options::fromCommandLine (args)).run(); });
+            return;
+        }
+
+        if (args.contains ("--idle-report"))
+        {
+            runHeadless ([args] { return IdleReport (IdleReport::Options::fromCommandLine (args)).run(); });
+            return;
+        }
+
+        auto replayLog = getCommandLineOption (args, "--replay");
+
+        if (replayLog.isNotEmpty())
+        {
+            auto cwd = juce::File::getCurrentWorkingDirectory();
+            auto output = getCommandLineOption (args, "--output");
+
+            runHeadless ([=] { return SessionReplay (cwd.getChildFile (replayLog),
+                                                     output.isNotEmpty() ? cwd.getChildFile (output) : juce::File()).run(); });
+            return;
+        }
+
+        mainWindow.reset (new MainWindow ("SynthUsingMidiInputTutorial", new MainContentComponent, *this));
+        startupProfile.mark ("window");
+
+        if (startupProfile.isEnabled())
+            reportStartupWhenAudioStarts (startupTimeoutMilliseconds);
+    }
+
+    void shutdown() override                         { mainWindow = nullptr; }
+
+private:
+    /** Runs a command-line tool instead of opening the window, then quits with its result. */
+    void runHeadless (std::function<int()> tool)
+    {
+        setApplicationReturnValue (tool());
+        quit();
+    }
+
+    /** Prints the --profile-startup breakdown and quits once the first audio
+        block has been rendered, or after the timeout on machines without an
+        audio device.
+    */
+    void reportStartupWhenAudioStarts (int millisecondsLeft)
+    {
+        if (startupProfile.hasAudioStarted() || millisecondsLeft <= 0)
+        {
+            startupProfile.print();
+            quit();
+            return;
+        }
+
+        juce::Timer::callAfterDelay (startupPollMilliseconds, [this, millisecondsLeft]
+        {
+            reportStartupWhenAudioStarts (millisecondsLeft - startupPollMilliseconds);
+        });
+    }
+
+    static constexpr int startupPollMilliseconds = 5;
+    static constexpr int startupTimeoutMilliseconds = 10000;
+
+    //==============================================================================
+    class MainWindow    : public juce::DocumentWindow
+    {
+    public:
+        MainWindow (const juce::String& name, juce::Component* c, JUCEApplication& a)
+            : DocumentWindow (name, juce::Desktop::getInstance().getDefaultLookAndFeel()
+                                                                .findColour (ResizableWindow::backgroundColourId),
+                              juce::DocumentWindow::allButtons),
+              app (a)
+        {
+            setUsingNativeTitleBar (true);
+            setContentOwned (c, true);
+
+           #if JUCE_ANDROID || JUCE_IOS
+            setFullScreen (true);
+           #else
+            setResizable (true, false);
+            setResizeLimits (300, 250, 10000, 10000);
+            centreWithSize (getWidth(), getHeight());
+           #endif
+
+            setVisible (true);
+        }
+
+        void closeButtonPressed() override
+        {
+            app.systemRequestedQuit();
+        }
+
+    private:
+        JUCEApplication& app;
+
+        //==============================================================================
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MainWindow)
+    };
+
+    std::unique_ptr<MainWindow> mainWindow;
+};
+
+//==============================================================================
+START_JUCE_APPLICATION (Application)
@@ -0,0 +1,358 @@
+/*
+  ==============================================================================
+
+    MasterEffects.h
+
+    Stereo chorus and tempo-synced delay on the master bus, run after the
+    synth has rendered. Every delay line is a power-of-two ring buffer sized
+    in prepare(), so the audio thread only ever reads and writes into memory
+    that already exists. Modulation and delay-time smoothing are worked out
+    once per control block of controlBlockSize samples.
+
+    A constant delay is read with vector copies straight off the ring. A
+    moving one, like the chorus, still gathers its two neighbouring samples
+    one at a time, since each lands at its own offset; only the
+    interpolation between them is done with vector operations.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "ScratchArena.h"
+#include "FastSine.h"
+
+//==============================================================================
+/** A mono ring buffer with linearly interpolated fractional reads. Reads are
+    taken relative to where the next write will land, so read a chunk before
+    writing it, with a delay of at least the chunk length plus one sample.
+*/
+class DelayLine
+{
+public:
+    DelayLine() = default;
+
+    /** Not real-time safe. */
+    void prepare (int maxDelaySamples, int maxChunkSize)
+    {
+        auto size = juce::nextPowerOfTwo (maxDelaySamples + maxChunkSize + 2);
+
+        buffer.allocate ((size_t) size, true);
+        mask = size - 1;
+        writePosition = 0;
+
+        maxChunk = maxChunkSize;
+        olderSamples.allocate ((size_t) maxChunk, true);
+        fractions.allocate ((size_t) maxChunk, true);
+    }
+
+    void clear() noexcept
+    {
+        juce::FloatVectorOperations::clear (buffer.get(), mask + 1);
+        writePosition = 0;
+    }
+
+    void write (const float* source, int numSamples) noexcept
+    {
+        auto first = juce::jmin (numSamples, mask + 1 - writePosition);
+
+        juce::FloatVectorOperations::copy (buffer + writePosition, source, first);
+        juce::FloatVectorOperations::copy (buffer.get(), source + first, numSamples - first);
+
+        writePosition = (writePosition + numSamples) & mask;
+    }
+
+    /** Fills dest with numSamples read at a delay ramping linearly from
+        delayStart to delayEnd. A constant delay runs as two vector passes
+        over the ring. A moving one gathers each sample's pair of neighbours
+        and its fraction, then interpolates the whole chunk with vector ops.
+    */
+    void read (float* dest, int numSamples, float delayStart, float delayEnd) noexcept
+    {
+        jassert (juce::jmin (delayStart, delayEnd) >= (float) numSamples + 1.0f);
+        jassert (numSamples <= maxChunk);
+
+        if (delayStart == delayEnd)
+        {
+            auto whole = (int) delayStart;
+            auto fraction = delayStart - (float) whole;
+
+            readRun (dest, numSamples, writePosition - whole, 1.0f - fraction, false);
+
+            if (fraction > 0.0f)
+                readRun (dest, numSamples, writePosition - whole - 1, fraction, true);
+
+            return;
+        }
+
+        auto delayStep = (delayEnd - delayStart) / (float) numSamples;
+        auto* samples = buffer.get();
+        auto* older = olderSamples.get();
+
+        for (auto i = 0; i < numSamples; ++i)
+        {
+            auto delay = delayStart + delayStep * (float) i;
+            auto whole = (int) delay;
+            auto index = writePosition + i - whole;
+
+            fractions[i] = delay - (float) whole;
+            dest[i] = samples[index & mask];
+            older[i] = samples[(index - 1) & mask];
+        }
+
+        // dest += fraction * (older - dest)
+        juce::FloatVectorOperations::subtract (older, dest, numSamples);
+        juce::FloatVectorOperations::addWithMultiply (dest, older, fractions.get(), numSamples);
+    }
+
+    size_t getMemoryUsage() const noexcept
+    {
+        return buffer != nullptr ? ((size_t) (mask + 1) + 2 * (size_t) maxChunk) * sizeof (float) : 0;
+    }
+
+private:
+    /** Copies or accumulates gain * ring[start, start + numSamples), splitting
+        the run where it wraps.
+    */
+    void readRun (float* dest, int numSamples, int start, float gain, bool accumulate) const noexcept
+    {
+        start &= mask;
+        auto first = juce::jmin (numSamples, mask + 1 - start);
+
+        if (accumulate)
+        {
+            juce::FloatVectorOperations::addWithMultiply (dest, buffer + start, gain, first);
+            juce::FloatVectorOperations::addWithMultiply (dest + first, buffer.get(), gain, numSamples - first);
+        }
+        else
+        {
+            juce::FloatVectorOperations::copyWithMultiply (dest, buffer + start, gain, first);
+            juce::FloatVectorOperations::copyWithMultiply (dest + first, buffer.get(), gain, numSamples - first);
+        }
+    }
+
+    juce::HeapBlock<float> buffer, olderSamples, fractions;
+    int mask = 0, writePosition = 0, maxChunk = 0;
+
+    JUCE_DECLARE_NON_COPYABLE (DelayLine)
+};
+
+//==============================================================================
+class MasterEffects
+{
+public:
+    static constexpr int maxChannels = 2;
+    static constexpr int controlBlockSize = 32;
+    static constexpr double maxDelaySeconds = 2.0;
+
+    /** Arena space process() takes, whatever the block size: two control blocks. */
+    static constexpr size_t scratchBytes = 2 * ScratchArena::getAlignedBytes (controlBlockSize);
+
+    MasterEffects() = default;
+
+    //==============================================================================
+    void setChorusEnabled (bool shouldBeEnabled) noexcept    { chorusEnabled = shouldBeEnabled; }
+    bool isChorusEnabled() const noexcept                    { return chorusEnabled; }
+
+    void setDelayEnabled (bool shouldBeEnabled) noexcept     { delayEnabled = shouldBeEnabled; }
+    bool isDelayEnabled() const noexcept                     { return delayEnabled; }
+
+    void setTempo (double bpm) noexcept                      { tempo = juce::jmax (1.0, bpm); }
+    double getTempo() const noexcept                         { return tempo; }
+
+    /** Delay time in quarter notes at the current tempo, e.g. 0.75 for a dotted eighth. */
+    void setDelayBeats (double beats) noexcept               { delayBeats = juce::jmax (0.0, beats); }
+    double getDelayBeats() const noexcept                    { return delayBeats; }
+
+    void setDelayFeedback (float feedback) noexcept          { delayFeedback = juce::jlimit (0.0f, 0.95f, feedback); }
+    float getDelayFeedback() const noexcept                  { return delayFeedback; }
+
+    void setDelayMix (float mix) noexcept                    { delayMix = juce::jlimit (0.0f, 1.0f, mix); }
+    float getDelayMix() const noexcept                       { return delayMix; }
+
+    //==============================================================================
+    /** Not real-time safe; allocates every delay line for maxDelaySeconds. */
+    void prepare (double newSampleRate)
+    {
+        sampleRate = newSampleRate;
+
+        auto maxDelaySamples = (int) std::ceil (maxDelaySeconds * sampleRate);
+        auto maxChorusSamples = (int) std::ceil ((chorusDelayMs + chorusDepthMs) * 0.001 * sampleRate);
+
+        for (auto& line : delayLines)   line.prepare (maxDelaySamples, controlBlockSize);
+        for (auto& line : chorusLines)  line.prepare (maxChorusSamples, controlBlockSize);
+
+        chorusPhase = 0.0;
+        currentDelay = getTargetDelay();
+        chorusWasEnabled = delayWasEnabled = false;
+    }
+
+    /** How long the enabled effects keep sounding after their input goes
+        silent: the chorus line's length, or enough delay repeats for the
+        feedback to fall below -80 dB.
+    */
+    int getTailSamples() const noexcept
+    {
+        auto tail = 0.0;
+
+        if (chorusEnabled)
+            tail = (chorusDelayMs + chorusDepthMs) * 0.001 * sampleRate;
+
+        if (delayEnabled)
+        {
+            auto feedback = (double) delayFeedback.load();
+            auto repeats = feedback > 0.0 ? std::ceil (std::log (1.0e-4) / std::log (feedback)) : 0.0;
+
+            tail = juce::jmax (tail, (repeats + 1.0) * juce::jmax ((double) currentDelay, (double) getTargetDelay()));
+        }
+
+        return (int) std::ceil (tail);
+    }
+
+    size_t getMemoryUsage() const noexcept
+    {
+        size_t bytes = 0;
+
+        for (auto& line : delayLines)   bytes += line.getMemoryUsage();
+        for (auto& line : chorusLines)  bytes += line.getMemoryUsage();
+
+        return bytes;
+    }
+
+    /** Runs the enabled effects in place over [startSample, startSample + numSamples),
+        taking scratchBytes from the arena. An effect that has
+        been switched back on starts from a silent line.
+    */
+    void process (juce::AudioBuffer<float>& buffer, int startSample, int numSamples, ScratchArena& arena) noexcept
+    {
+        auto useChorus = chorusEnabled.load();
+        auto useDelay = delayEnabled.load();
+
+        if (useChorus && ! chorusWasEnabled)
+            for (auto& line : chorusLines)
+                line.clear();
+
+        if (useDelay && ! delayWasEnabled)
+        {
+            for (auto& line : delayLines)
+                line.clear();
+
+            currentDelay = getTargetDelay();
+        }
+
+        chorusWasEnabled = useChorus;
+        delayWasEnabled = useDelay;
+
+        if (! (useChorus || useDelay) || numSamples <= 0)
+            return;
+
+        const ScratchArena::ScopedRewind rewind (arena);
+        auto* wet = arena.allocate (controlBlockSize);
+        auto* feed = arena.allocate (controlBlockSize);
+
+        if (wet == nullptr || feed == nullptr)
+            return;
+
+        auto numChannels = juce::jmin (buffer.getNumChannels(), maxChannels);
+        auto targetDelay = getTargetDelay();
+        auto feedback = delayFeedback.load();
+        auto mix = delayMix.load();
+
+        for (auto offset = 0; offset < numSamples; offset += controlBlockSize)
+        {
+            auto chunk = juce::jmin (controlBlockSize, numSamples - offset);
+
+            if (useChorus)
+                processChorus (buffer, numChannels, startSample + offset, chunk, wet);
+
+            if (useDelay)
+            {
+                auto delayStart = currentDelay;
+                currentDelay = smoothDelay (currentDelay, targetDelay, chunk);
+
+                for (auto channel = 0; channel < numChannels; ++channel)
+                {
+                    auto* samples = buffer.getWritePointer (channel, startSample + offset);
+                    auto& line = delayLines[(size_t) channel];
+
+                    line.read (wet, chunk, delayStart, currentDelay);
+
+                    juce::FloatVectorOperations::copy (feed, samples, chunk);
+                    juce::FloatVectorOperations::addWithMultiply (feed, wet, feedback, chunk);
+                    line.write (feed, chunk);
+
+                    juce::FloatVectorOperations::addWithMultiply (samples, wet, mix, chunk);
+                }
+            }
+        }
+    }
+
+private:
+    static constexpr double chorusDelayMs = 12.0, chorusDepthMs = 3.0, chorusRateHz = 0.8;
+    static constexpr float chorusMix = 0.5f;
+    static constexpr double delaySmoothingSeconds = 0.1;
+
+    /** The LFO is evaluated at each end of the chunk and the read delay ramps
+        between them; the right channel runs a quarter cycle ahead of the left.
+    */
+    void processChorus (juce::AudioBuffer<float>& buffer, int numChannels, int start, int chunk, float* wet) noexcept
+    {
+        auto phaseStart = chorusPhase;
+        chorusPhase += chorusRateHz * chunk / sampleRate;
+        chorusPhase -= std::floor (chorusPhase);
+
+        auto phaseEnd = phaseStart + chorusRateHz * chunk / sampleRate;
+
+        for (auto channel = 0; channel < numChannels; ++channel)
+        {
+            auto* samples = buffer.getWritePointer (channel, start);
+            auto& line = chorusLines[(size_t) channel];
+            auto offset = 0.25 * channel;
+
+            line.read (wet, chunk, getChorusDelay (phaseStart + offset), getChorusDelay (phaseEnd + offset));
+            line.write (samples, chunk);
+
+            juce::FloatVectorOperations::addWithMultiply (samples, wet, chorusMix, chunk);
+        }
+    }
+
+    float getChorusDelay (double phase) const noexcept
+    {
+        auto lfo = FastSine::sinTurns ((float) phase);
+        return (float) ((chorusDelayMs + chorusDepthMs * lfo) * 0.001 * sampleRate);
+    }
+
+    /** The tempo-synced delay, clamped to what the lines can hold and to the
+        shortest delay a control block can read.
+    */
+    float getTargetDelay() const noexcept
+    {
+        auto samples = delayBeats.load() * 60.0 / tempo.load() * sampleRate;
+        return (float) juce::jlimit (controlBlockSize + 1.0, maxDelaySeconds * sampleRate, samples);
+    }
+
+    /** Glides towards a new delay time so tempo changes bend rather than click,
+        snapping once close enough for the constant-delay read path to take over.
+    */
+    float smoothDelay (float current, float target, int chunk) const noexcept
+    {
+        auto coefficient = (float) (1.0 - std::exp (-chunk / (delaySmoothingSeconds * sampleRate)));
+        auto next = current + coefficient * (target - current);
+
+        return std::abs (target - next) < 0.001f ? target : next;
+    }
+
+    //==============================================================================
+    std::atomic<bool> chorusEnabled { false }, delayEnabled { false };
+    std::atomic<double> tempo { 120.0 }, delayBeats { 0.75 };
+    std::atomic<float> delayFeedback { 0.35f }, delayMix { 0.3f };
+
+    double sampleRate = 44100.0, chorusPhase = 0.0;
+    float currentDelay = 0.0f;
+    bool chorusWasEnabled = false, delayWasEnabled = false;
+
+    std::array<DelayLine, maxChannels> delayLines, chorusLines;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MasterEffects)
+};
@@ -0,0 +1,127 @@
+/*
+  ==============================================================================
+
+    MemoryReport.h
+
+    Prints the engine's memory breakdown, then plays a long random note stream
+    offline and checks that the footprint hasn't moved. Every figure is what
+    is actually allocated (MIDI buffer storage, vector capacities, voices
+    owned), so anything growing on the audio thread fails it, as does a
+    scratch arena high-water mark above its capacity; the effects are
+    switched on so every stage that uses the arena runs. With a wavetable
+    budget, tables are evicted and rebuilt as the notes need them, so it
+    checks that they stayed within the budget instead. Levels built on
+    demand may likewise grow the tables, but nothing else. Run it with
+    --memory-report [--notes=N] [--wavetable-budget=KB]; see Main.cpp.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <iostream>
+#include "CommandLineOptions.h"
+
+//==============================================================================
+class MemoryReport
+{
+public:
+    explicit MemoryReport (int notesToPlay, int wavetableBudgetKB = 0)
+        : numNotes (notesToPlay), wavetableBudget ((size_t) juce::jmax (0, wavetableBudgetKB) * 1024) {}
+
+    /** Returns 0 if the footprint after the note stream matches the one before. */
+    int run()
+    {
+        juce::MidiKeyboardState keyboardState;
+        SynthAudioSource source (keyboardState);
+        juce::AudioSampleBuffer buffer (2, blockSize);
+        juce::Random random (42);
+
+        source.prepareToPlay (blockSize, sampleRate);
+        source.getWavetableManager().setBudget (wavetableBudget);
+
+        // so every stage that takes scratch space runs, for the high-water check
+        source.getMasterEffects().setChorusEnabled (true);
+        source.getMasterEffects().setDelayEnabled (true);
+
+        // one block so anything sized lazily on first use is counted in the baseline
+        source.getNextAudioBlock (juce::AudioSourceChannelInfo (buffer));
+
+        auto before = source.getMemoryUsage();
+        auto residencyBefore = source.getWavetableManager().getResidency();
+
+        std::cout << "before: " << before.toString() << std::endl
+                  << "        wavetables " << residencyBefore.toString() << std::endl;
+
+        auto& collector = *source.getMidiCollector();
+
+        for (auto i = 0; i < numNotes; ++i)
+        {
+            auto note = 24 + random.nextInt (84);
+            auto now = juce::Time::getMillisecondCounterHiRes() * 0.001;
+
+            collector.addMessageToQueue (juce::MidiMessage::noteOn (1, note, (juce::uint8) (1 + random.nextInt (127))).withTimeStamp (now));
+            source.getNextAudioBlock (juce::AudioSourceChannelInfo (buffer));
+
+            collector.addMessageToQueue (juce::MidiMessage::noteOff (1, note).withTimeStamp (now));
+            source.getNextAudioBlock (juce::AudioSourceChannelInfo (buffer));
+        }
+
+        auto after = source.getMemoryUsage();
+        auto residency = source.getWavetableManager().getResidency();
+
+        auto& arena = source.getScratchArena();
+
+        std::cout << "after " << numNotes << " notes: " << after.toString() << std::endl
+                  << "        wavetables " << residency.toString() << std::endl
+                  << "        scratch high-water " << MemoryUsage::formatBytes (arena.getHighWaterMark())
+                  << " of " << MemoryUsage::formatBytes (arena.getCapacity()) << std::endl;
+
+        if (arena.getHighWaterMark() > arena.getCapacity())
+        {
+            std::cout << "FAILED: scratch arena too small" << std::endl;
+            return 1;
+        }
+
+        if (wavetableBudget > 0 || residencyBefore.residentLevels < residencyBefore.totalLevels)
+        {
+            // the rest of the footprint must still hold still
+            after.wavetables = before.wavetables;
+
+            if (wavetableBudget > 0 && residency.residentBytes > wavetableBudget)
+            {
+                std::cout << "FAILED: wavetables over budget" << std::endl;
+                return 1;
+            }
+        }
+
+        if (after != before)
+        {
+            std::cout << "FAILED: steady-state footprint changed:";
+
+            auto reportChange = [] (const char* name, size_t was, size_t is)
+            {
+                if (was != is)
+                    std::cout << ' ' << name << ' ' << MemoryUsage::formatBytes (was) << " -> " << MemoryUsage::formatBytes (is);
+            };
+
+            reportChange ("voices", before.voices, after.voices);
+            reportChange ("MIDI", before.midiBuffers, after.midiBuffers);
+            reportChange ("scratch", before.scratchBuffers, after.scratchBuffers);
+            reportChange ("effects", before.effects, after.effects);
+            reportChange ("wavetables", before.wavetables, after.wavetables);
+            std::cout << std::endl;
+            return 1;
+        }
+
+        return 0;
+    }
+
+private:
+    static constexpr int blockSize = 256;
+    static constexpr double sampleRate = 48000.0;
+
+    int numNotes;
+    size_t wavetableBudget;
+};
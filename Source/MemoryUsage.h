@@ -0,0 +1,68 @@
+/*
+  ==============================================================================
+
+    MemoryUsage.h
+
+    Bytes held by each part of the engine, as reported by
+    SynthAudioSource::getMemoryUsage().
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+struct MemoryUsage
+{
+    size_t wavetables = 0, voices = 0, midiBuffers = 0, scratchBuffers = 0, effects = 0;
+
+    size_t getTotal() const noexcept
+    {
+        return wavetables + voices + midiBuffers + scratchBuffers + effects;
+    }
+
+    bool operator== (const MemoryUsage& other) const noexcept
+    {
+        return wavetables == other.wavetables && voices == other.voices && midiBuffers == other.midiBuffers
+                && scratchBuffers == other.scratchBuffers && effects == other.effects;
+    }
+
+    bool operator!= (const MemoryUsage& other) const noexcept    { return ! operator== (other); }
+
+    /** What a container has actually allocated, rather than what it was
+        asked to hold, so growth on the audio thread shows up.
+    */
+    static size_t getAllocatedBytes (const juce::MidiBuffer& buffer) noexcept
+    {
+        return (size_t) buffer.data.getNumAllocated();
+    }
+
+    template <typename Type>
+    static size_t getAllocatedBytes (const std::vector<Type>& vector) noexcept
+    {
+        return vector.capacity() * sizeof (Type);
+    }
+
+    static juce::String formatBytes (size_t bytes)
+    {
+        if (bytes >= 1024 * 1024)
+            return juce::String ((double) bytes / (1024.0 * 1024.0), 1) + " MB";
+
+        if (bytes >= 1024)
+            return juce::String ((double) bytes / 1024.0, 1) + " KB";
+
+        return juce::String ((int) bytes) + " B";
+    }
+
+    juce::String toString() const
+    {
+        return "total " + formatBytes (getTotal())
+                + " (wavetables " + formatBytes (wavetables)
+                + ", voices " + formatBytes (voices)
+                + ", MIDI " + formatBytes (midiBuffers)
+                + ", scratch " + formatBytes (scratchBuffers)
+                + ", effects " + formatBytes (effects) + ")";
+    }
+};
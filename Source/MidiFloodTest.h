@@ -0,0 +1,215 @@
+/*
+  ==============================================================================
+
+    MidiFloodTest.h
+
+    Drives a SynthAudioSource with no audio device, pushing a configurable
+    storm of note-ons, note-offs and CCs through its MidiMessageCollector.
+    Blocks are paced in real time so the collector sees the same timing it
+    would live. Each event's send time is compared with where in the audio
+    it was delivered, so events held up past their block are counted.
+    Run it with --midi-flood; see Main.cpp.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <iostream>
+#include "CommandLineOptions.h"
+
+//==============================================================================
+class MidiFloodTest
+{
+public:
+    struct Options
+    {
+        double eventsPerSecond = 10000.0;
+        double seconds = 10.0;
+        double sampleRate = 48000.0;
+        int blockSize = 256;
+
+        /** Fails if any block takes longer than this fraction of its real-time period. */
+        double maxBlockLoad = 0.5;
+
+        /** Fails if more events than this were delivered over a block later
+            than they were sent.
+        */
+        int maxLateEvents = 0;
+
+        /** Negative means voice steals are reported but never fail the run. */
+        juce::int64 maxVoiceSteals = -1;
+
+        /** See SineWaveSynth::setRenderCache(); off by default. */
+        double renderCacheMilliseconds = 0.0;
+        int renderCacheEntries = 64;
+
+        static Options fromCommandLine (const juce::StringArray& args)
+        {
+            Options o;
+            o.eventsPerSecond  = getCommandLineOption (args, "--rate", o.eventsPerSecond);
+            o.seconds          = getCommandLineOption (args, "--seconds", o.seconds);
+            o.sampleRate       = getCommandLineOption (args, "--sample-rate", o.sampleRate);
+            o.blockSize        = getCommandLineOption (args, "--block-size", o.blockSize);
+            o.maxBlockLoad     = getCommandLineOption (args, "--max-block-load", o.maxBlockLoad);
+            o.maxLateEvents    = getCommandLineOption (args, "--max-late", o.maxLateEvents);
+            o.maxVoiceSteals   = getCommandLineOption (args, "--max-steals", (int) o.maxVoiceSteals);
+            o.renderCacheMilliseconds = getCommandLineOption (args, "--render-cache-ms", o.renderCacheMilliseconds);
+            o.renderCacheEntries      = getCommandLineOption (args, "--render-cache-entries", o.renderCacheEntries);
+            return o;
+        }
+    };
+
+    explicit MidiFloodTest (Options optionsToUse)  : options (std::move (optionsToUse)) {}
+
+    /** Prints a summary and returns 0 if every threshold held, 1 otherwise. */
+    int run()
+    {
+        juce::MidiKeyboardState keyboardState;
+        SynthAudioSource source (keyboardState);
+        juce::AudioSampleBuffer buffer (2, options.blockSize);
+
+        source.prepareToPlay (options.blockSize, options.sampleRate);
+        source.getSynth().setRenderCache (options.renderCacheMilliseconds, options.renderCacheEntries);
+
+        auto& collector = *source.getMidiCollector();
+        auto blockSeconds = options.blockSize / options.sampleRate;
+        auto numBlocks = juce::jmax (1, (int) (options.seconds / blockSeconds));
+        auto eventsPerBlock = options.eventsPerSecond * blockSeconds;
+
+        std::vector<double> renderTimes, sendTimes;
+        renderTimes.reserve ((size_t) numBlocks);
+        sendTimes.reserve ((size_t) (eventsPerBlock * numBlocks) + 1);
+
+        juce::int64 lateEvents = 0;
+        size_t numDelivered = 0;
+        auto maxLateness = 0.0;
+        auto eventBudget = 0.0;
+        auto startTime = juce::Time::getMillisecondCounterHiRes();
+
+        for (auto block = 0; block <= numBlocks; ++block)
+        {
+            // the extra final block only drains what's left in the collector
+            if (block < numBlocks)
+            {
+                eventBudget += eventsPerBlock;
+
+                for (; eventBudget >= 1.0; eventBudget -= 1.0)
+                {
+                    auto message = nextMessage();
+                    sendTimes.push_back (juce::Time::getMillisecondCounterHiRes());
+                    message.setTimeStamp (sendTimes.back() * 0.001);
+                    collector.addMessageToQueue (message);
+                }
+            }
+
+            waitUntil (startTime + 1000.0 * blockSeconds * (block + 1));
+
+            auto callbackTime = juce::Time::getMillisecondCounterHiRes();
+            auto startTicks = juce::Time::getHighResolutionTicks();
+            source.getNextAudioBlock (juce::AudioSourceChannelInfo (buffer));
+            renderTimes.push_back (juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks() - startTicks));
+
+            // the collector maps the block onto the period that ended at the callback,
+            // and hands events over in the order they were sent
+            auto blockStartTime = callbackTime - 1000.0 * blockSeconds;
+
+            for (const auto metadata : source.getLastBlockMidi())
+            {
+                if (numDelivered == sendTimes.size())
+                    break;
+
+                auto deliveredTime = blockStartTime + 1000.0 * metadata.samplePosition / options.sampleRate;
+                auto lateness = deliveredTime - sendTimes[numDelivered++];
+
+                maxLateness = juce::jmax (maxLateness, lateness);
+
+                if (lateness > 1000.0 * blockSeconds)
+                    ++lateEvents;
+            }
+        }
+
+        auto stats = source.getStatistics();
+
+        std::sort (renderTimes.begin(), renderTimes.end());
+        auto percentile = [&] (double p) { return renderTimes[(size_t) (p * (double) (renderTimes.size() - 1))]; };
+        auto maxLoad = renderTimes.back() / blockSeconds;
+
+        std::cout << "events sent:        " << sendTimes.size() << std::endl
+                  << "events received:    " << stats.midiEventsReceived << std::endl
+                  << "late events:        " << lateEvents << " (delivered over a block after sending)" << std::endl
+                  << "max lateness:       " << maxLateness << " ms" << std::endl
+                  << "voice steals:       " << stats.voiceSteals << std::endl
+                  << "early releases:     " << stats.earlyReleases << std::endl
+                  << "render cache hits:  " << stats.renderCacheHits << std::endl
+                  << "arpeggiator drops:  " << stats.arpeggiatorDrops << std::endl
+                  << "render us/block:    median " << percentile (0.5) * 1.0e6
+                  << ", p99 " << percentile (0.99) * 1.0e6
+                  << ", max " << renderTimes.back() * 1.0e6 << std::endl
+                  << "max block load:     " << maxLoad * 100.0 << "%" << std::endl;
+
+        auto passed = true;
+        auto check = [&passed] (bool ok, const char* what)
+        {
+            if (! ok)
+            {
+                std::cout << "FAILED: " << what << std::endl;
+                passed = false;
+            }
+        };
+
+        check (maxLoad <= options.maxBlockLoad, "block render time over threshold");
+        check (lateEvents <= options.maxLateEvents, "late events over threshold");
+        check (options.maxVoiceSteals < 0 || stats.voiceSteals <= options.maxVoiceSteals, "voice steals over threshold");
+
+        return passed ? 0 : 1;
+    }
+
+private:
+    /** Roughly 40% note-ons, 40% note-offs of sounding notes and 20% CCs. */
+    juce::MidiMessage nextMessage()
+    {
+        auto choice = random.nextInt (10);
+
+        if (choice < 4 || (choice < 8 && numSounding == 0))
+        {
+            auto note = 36 + random.nextInt (61);
+
+            if (numSounding < (int) sounding.size())
+                sounding[(size_t) numSounding++] = note;
+
+            return juce::MidiMessage::noteOn (1, note, (juce::uint8) (1 + random.nextInt (127)));
+        }
+
+        if (choice < 8)
+        {
+            auto index = random.nextInt (numSounding);
+            auto note = sounding[(size_t) index];
+            sounding[(size_t) index] = sounding[(size_t) --numSounding];
+
+            return juce::MidiMessage::noteOff (1, note);
+        }
+
+        return juce::MidiMessage::controllerEvent (1, 1 + random.nextInt (100), random.nextInt (128));
+    }
+
+    static void waitUntil (double targetMilliseconds)
+    {
+        for (;;)
+        {
+            auto remaining = targetMilliseconds - juce::Time::getMillisecondCounterHiRes();
+
+            if (remaining <= 0.0)
+                return;
+
+            if (remaining > 2.0)
+                juce::Thread::sleep ((int) remaining - 1);
+        }
+    }
+
+    Options options;
+    juce::Random random { 1234 };
+    std::array<int, 1024> sounding;
+    int numSounding = 0;
+};
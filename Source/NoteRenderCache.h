@@ -0,0 +1,166 @@
+/*
+  ==============================================================================
+
+    NoteRenderCache.h
+
+    The opening milliseconds of recently played notes, kept so that a note
+    retriggered with the same sound, pitch and velocity can copy them rather
+    than run its oscillators again. All memory is one pool allocated in
+    prepare(), and entries are reused least recently used first.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/** HandOff is whatever a voice needs to carry on live from the end of an
+    entry exactly as if it had rendered it, e.g. its oscillators' state.
+
+    Entries are filled by the first voice to play a note and are only read
+    once complete. A voice reading an entry pins it until release(), so it is
+    never reused under a note still playing from it. Everything here runs on
+    the audio thread, under the synth's lock, apart from prepare().
+*/
+template <typename HandOff>
+class NoteRenderCache
+{
+public:
+    /** What makes two notes' oscillator output identical at a given sample rate. */
+    struct Key
+    {
+        const void* sound = nullptr;
+        int oscillator = 0, note = 0, velocity = 0;
+
+        bool operator== (const Key& other) const noexcept
+        {
+            return sound == other.sound && oscillator == other.oscillator
+                    && note == other.note && velocity == other.velocity;
+        }
+    };
+
+    NoteRenderCache() = default;
+
+    /** Not real-time safe, and drops everything cached. No voice may still be
+        holding an entry. Either argument being 0 turns the cache off.
+    */
+    void prepare (int numEntries, int samplesPerEntry)
+    {
+        entrySamples = numEntries > 0 ? juce::jmax (0, samplesPerEntry) : 0;
+        entries.assign (entrySamples > 0 ? (size_t) numEntries : 0, {});
+        samples.assign (entries.size() * (size_t) entrySamples, 0.0f);
+        useCounter = 0;
+    }
+
+    bool isEnabled() const noexcept                  { return entrySamples > 0; }
+    int getEntrySamples() const noexcept             { return entrySamples; }
+
+    /** Returns a complete entry for key, pinned until release(), or -1. */
+    int acquire (const Key& key) noexcept
+    {
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            auto& entry = entries[i];
+
+            if (entry.complete && entry.key == key)
+            {
+                ++entry.readers;
+                entry.lastUsed = ++useCounter;
+                ++hits;
+                return (int) i;
+            }
+        }
+
+        return -1;
+    }
+
+    /** After acquire() has missed: claims the least recently used entry that
+        nobody is reading for the caller to fill. Returns -1 if another voice
+        is already filling this key or every entry is in use.
+    */
+    int beginFill (const Key& key) noexcept
+    {
+        auto victim = -1;
+
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            auto& entry = entries[i];
+
+            if (entry.filling && entry.key == key)
+                return -1;
+
+            if (entry.filling || entry.readers > 0)
+                continue;
+
+            if (victim < 0 || entry.lastUsed < entries[(size_t) victim].lastUsed)
+                victim = (int) i;
+        }
+
+        if (victim >= 0)
+        {
+            auto& entry = entries[(size_t) victim];
+            entry.key = key;
+            entry.complete = false;
+            entry.filling = true;
+            entry.lastUsed = ++useCounter;
+        }
+
+        return victim;
+    }
+
+    float* getSamples (int entry) noexcept                      { return samples.data() + (size_t) entry * (size_t) entrySamples; }
+    const HandOff& getHandOff (int entry) const noexcept        { return entries[(size_t) entry].handOff; }
+
+    /** The filling voice has written all getEntrySamples() samples. */
+    void finishFill (int entry, const HandOff& handOff) noexcept
+    {
+        auto& e = entries[(size_t) entry];
+        e.handOff = handOff;
+        e.filling = false;
+        e.complete = true;
+    }
+
+    /** The filling voice stopped, or stopped being repeatable, part way through. */
+    void abandonFill (int entry) noexcept
+    {
+        auto& e = entries[(size_t) entry];
+        e.filling = false;
+        e.complete = false;
+        e.lastUsed = 0;
+    }
+
+    void release (int entry) noexcept
+    {
+        auto& e = entries[(size_t) entry];
+        jassert (e.readers > 0);
+        --e.readers;
+    }
+
+    /** Notes that started from the cache. */
+    juce::int64 getNumHits() const noexcept          { return hits; }
+
+    size_t getMemoryUsage() const noexcept
+    {
+        return samples.capacity() * sizeof (float) + entries.capacity() * sizeof (Entry);
+    }
+
+private:
+    struct Entry
+    {
+        Key key;
+        HandOff handOff;
+        juce::uint64 lastUsed = 0;
+        int readers = 0;
+        bool filling = false, complete = false;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<float> samples;
+    int entrySamples = 0;
+    juce::uint64 useCounter = 0;
+    std::atomic<juce::int64> hits { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE (NoteRenderCache)
+};
@@ -0,0 +1,219 @@
+/*
+  ==============================================================================
+
+    OscillatorBenchmark.h
+
+    Compares the PolyBLEP oscillators with the wavetable path for render cost
+    and aliasing, waveform by waveform. Run it with --benchmark-oscillators
+    [--table-size=N] [--notes=33,69,93,105]; see Main.cpp.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <complex>
+#include <iostream>
+#include "CommandLineOptions.h"
+
+//==============================================================================
+class OscillatorBenchmark
+{
+public:
+    struct Options
+    {
+        double sampleRate = 48000.0;
+        double secondsPerRun = 1.0;
+        int blockSize = 512;
+        int tableSize = 1 << 12;
+        std::vector<int> notes { 33, 69, 93, 105 };
+
+        static Options fromCommandLine (const juce::StringArray& args)
+        {
+            Options o;
+            o.sampleRate    = getCommandLineOption (args, "--sample-rate", o.sampleRate);
+            o.secondsPerRun = getCommandLineOption (args, "--seconds", o.secondsPerRun);
+            o.blockSize     = getCommandLineOption (args, "--block-size", o.blockSize);
+            o.tableSize     = getCommandLineOption (args, "--table-size", o.tableSize);
+            o.notes         = getCommandLineOption (args, "--notes", o.notes);
+            return o;
+        }
+    };
+
+    explicit OscillatorBenchmark (Options optionsToUse)  : options (std::move (optionsToUse)) {}
+
+    /** Prints one line per waveform, path and note, and returns a process exit code.
+        alias_db is the power of everything off the harmonic series relative to
+        the power on it. The pulse has no table equivalent, as MipmappedWavetable
+        only holds sine partials.
+    */
+    int run()
+    {
+        std::cout << "waveform,path,note,ns_per_sample,alias_db" << std::endl;
+
+        for (auto waveform : { PolyBlepOscillator::Waveform::saw, PolyBlepOscillator::Waveform::square,
+                               PolyBlepOscillator::Waveform::triangle, PolyBlepOscillator::Waveform::pulse })
+        {
+            std::unique_ptr<MipmappedWavetable> table;
+
+            if (waveform != PolyBlepOscillator::Waveform::pulse)
+            {
+                table = std::make_unique<MipmappedWavetable> (getHarmonicWeights (waveform), options.tableSize);
+                table->prepare (options.sampleRate);
+            }
+
+            for (auto note : options.notes)
+            {
+                auto frequency = getTestFrequency (note);
+
+                if (table != nullptr)
+                {
+                    WavetableOscillator osc (table->getTableForNote (note));
+                    report (waveform, "table", note, osc, frequency);
+                }
+
+                PolyBlepOscillator osc;
+                osc.setWaveform (waveform);
+                report (waveform, "polyblep", note, osc, frequency);
+            }
+        }
+
+        return 0;
+    }
+
+private:
+    static const char* getName (PolyBlepOscillator::Waveform waveform)
+    {
+        switch (waveform)
+        {
+            case PolyBlepOscillator::Waveform::square:    return "square";
+            case PolyBlepOscillator::Waveform::triangle:  return "triangle";
+            case PolyBlepOscillator::Waveform::pulse:     return "pulse";
+            case PolyBlepOscillator::Waveform::saw:
+            default:                                      return "saw";
+        }
+    }
+
+    /** Sine-series weights of the same waveform, as far as a table can hold them. */
+    std::vector<float> getHarmonicWeights (PolyBlepOscillator::Waveform waveform) const
+    {
+        std::vector<float> weights ((size_t) options.tableSize / 2, 0.0f);
+
+        for (size_t i = 0; i < weights.size(); ++i)
+        {
+            auto harmonic = (float) i + 1.0f;
+            auto isOdd = (i % 2) == 0;
+
+            if (waveform == PolyBlepOscillator::Waveform::saw)
+                weights[i] = 2.0f / (juce::MathConstants<float>::pi * harmonic);
+            else if (waveform == PolyBlepOscillator::Waveform::square && isOdd)
+                weights[i] = 4.0f / (juce::MathConstants<float>::pi * harmonic);
+            else if (waveform == PolyBlepOscillator::Waveform::triangle && isOdd)
+                weights[i] = ((i / 2) % 2 == 0 ? 8.0f : -8.0f) / (juce::MathConstants<float>::pi * juce::MathConstants<float>::pi * harmonic * harmonic);
+        }
+
+        return weights;
+    }
+
+    /** A whole number of hertz near the note, so one second holds whole cycles
+        and every harmonic falls exactly on a bin. It is nudged if the sample
+        rate is a multiple of it, which would fold the aliases onto harmonics.
+    */
+    float getTestFrequency (int note) const
+    {
+        auto frequency = juce::roundToInt (juce::MidiMessage::getMidiNoteInHertz (note));
+        auto sampleRate = juce::roundToInt (options.sampleRate);
+
+        while (sampleRate % frequency == 0)
+            ++frequency;
+
+        return (float) frequency;
+    }
+
+    template <typename OscillatorType>
+    void report (PolyBlepOscillator::Waveform waveform, const char* path, int note, OscillatorType& osc, float frequency)
+    {
+        osc.setFrequency (frequency, (float) options.sampleRate);
+        auto nanoseconds = measureSpeed (osc);
+
+        osc.resetPhase();
+        osc.setFrequency (frequency, (float) options.sampleRate);
+
+        std::cout << getName (waveform) << ',' << path << ',' << note << ','
+                  << nanoseconds << ',' << measureAliasing (osc, frequency) << std::endl;
+    }
+
+    static void render (WavetableOscillator& osc, float* dest, int numSamples) noexcept
+    {
+        for (auto i = 0; i < numSamples; ++i)
+            dest[i] = osc.getNextSample();
+    }
+
+    static void render (PolyBlepOscillator& osc, float* dest, int numSamples) noexcept
+    {
+        osc.renderBlock (dest, numSamples);
+    }
+
+    template <typename OscillatorType>
+    double measureSpeed (OscillatorType& osc)
+    {
+        juce::AudioSampleBuffer output (1, options.blockSize);
+        auto numBlocks = juce::jmax (1, (int) (options.secondsPerRun * options.sampleRate) / options.blockSize);
+
+        auto startTicks = juce::Time::getHighResolutionTicks();
+
+        for (auto block = 0; block < numBlocks; ++block)
+            render (osc, output.getWritePointer (0), options.blockSize);
+
+        auto elapsed = juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks() - startTicks);
+
+        // keep the optimiser from discarding the render
+        volatile auto sink = output.getSample (0, 0);
+        juce::ignoreUnused (sink);
+
+        return elapsed * 1.0e9 / ((double) numBlocks * options.blockSize);
+    }
+
+    /** Renders one second and takes each harmonic below Nyquist out of it with a
+        single-bin DFT; whatever power is left over is aliasing.
+    */
+    template <typename OscillatorType>
+    double measureAliasing (OscillatorType& osc, float frequency)
+    {
+        auto numSamples = juce::roundToInt (options.sampleRate);
+        std::vector<float> samples ((size_t) numSamples);
+        render (osc, samples.data(), numSamples);
+
+        double sum = 0.0, sumOfSquares = 0.0;
+
+        for (auto sample : samples)
+        {
+            sum += sample;
+            sumOfSquares += (double) sample * sample;
+        }
+
+        auto mean = sum / numSamples;
+        auto totalPower = sumOfSquares / numSamples - mean * mean;
+        auto harmonicPower = 0.0;
+
+        for (auto harmonic = 1; harmonic * (double) frequency < options.sampleRate * 0.5; ++harmonic)
+        {
+            auto angle = juce::MathConstants<double>::twoPi * harmonic * frequency / options.sampleRate;
+            std::complex<double> rotation (std::cos (angle), -std::sin (angle)), phasor (1.0, 0.0), bin;
+
+            for (auto sample : samples)
+            {
+                bin += (double) sample * phasor;
+                phasor *= rotation;
+            }
+
+            harmonicPower += 2.0 * std::norm (bin) / ((double) numSamples * numSamples);
+        }
+
+        auto aliasPower = juce::jmax (1.0e-20, totalPower - harmonicPower);
+        return 10.0 * std::log10 (aliasPower / harmonicPower);
+    }
+
+    Options options;
+};
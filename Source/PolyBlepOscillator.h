@@ -0,0 +1,245 @@
+/*
+  ==============================================================================
+
+    PolyBlepOscillator.h
+
+    Table-free saw, square, triangle and pulse oscillators. The naive
+    waveform is corrected with a two-sample polynomial residual around each
+    discontinuity (PolyBLEP) or each corner (PolyBLAMP for the triangle), which
+    takes out most of the aliasing without any stored tables.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/** Has the same frequency, glide and pitch ratio interface as
+    WavetableOscillator, so a voice can drive either one, but renders a whole
+    segment at a time.
+*/
+class PolyBlepOscillator
+{
+public:
+    enum class Waveform
+    {
+        saw = 1,
+        square,
+        triangle,
+        pulse
+    };
+
+    PolyBlepOscillator() = default;
+
+    void setWaveform (Waveform newWaveform) noexcept    { waveform = newWaveform; }
+    Waveform getWaveform() const noexcept               { return waveform; }
+
+    /** Duty cycle of the pulse wave; the square is always 0.5. */
+    void setPulseWidth (float newWidth) noexcept        { pulseWidth = juce::jlimit (0.05f, 0.95f, newWidth); }
+
+    void resetPhase() noexcept                          { phase = 0.0f; lastPhase = justBelowOne; }
+
+    /** Scales the phase increment on top of any glide, e.g. for vibrato. */
+    void setPitchRatio (float newRatio) noexcept        { pitchRatio = newRatio; }
+
+    void setFrequency (float frequency, float sampleRate) noexcept
+    {
+        phaseDelta = frequency / sampleRate;
+        targetDelta = phaseDelta;
+        glideSamplesRemaining = 0;
+        glideRatio = 1.0f;
+    }
+
+    /** Ramps the phase increment exponentially from its current value to the
+        given frequency over numSamples samples.
+    */
+    void glideToFrequency (float frequency, float sampleRate, int numSamples) noexcept
+    {
+        targetDelta = frequency / sampleRate;
+        glideSamplesRemaining = juce::jmax (0, numSamples);
+
+        if (glideSamplesRemaining == 0 || phaseDelta <= 0.0f)
+            setFrequency (frequency, sampleRate);
+    }
+
+    /** See WavetableOscillator::beginSegment(). */
+    int beginSegment (int maxSamples) noexcept
+    {
+        if (glideSamplesRemaining <= 0)
+            return maxSamples;
+
+        segmentLength = juce::jmin (maxSamples, glideSamplesRemaining);
+        segmentStartDelta = phaseDelta;
+        glideRatio = (float) std::pow ((double) targetDelta / phaseDelta, 1.0 / glideSamplesRemaining);
+
+        return segmentLength;
+    }
+
+    void endSegment() noexcept
+    {
+        if (glideSamplesRemaining <= 0)
+            return;
+
+        glideSamplesRemaining -= segmentLength;
+
+        if (glideSamplesRemaining > 0)
+        {
+            phaseDelta = segmentStartDelta * (float) std::pow ((double) glideRatio, (double) segmentLength);
+        }
+        else
+        {
+            phaseDelta = targetDelta;
+            glideRatio = 1.0f;
+        }
+    }
+
+    /** Overwrites dest with the next numSamples. The waveform is picked once
+        here, so none of the per-sample loops branch on it.
+    */
+    void renderBlock (float* dest, int numSamples) noexcept
+    {
+        switch (waveform)
+        {
+            case Waveform::square:    renderWaveform<Waveform::square>   (dest, numSamples); break;
+            case Waveform::triangle:  renderWaveform<Waveform::triangle> (dest, numSamples); break;
+            case Waveform::pulse:     renderWaveform<Waveform::pulse>    (dest, numSamples); break;
+            case Waveform::saw:
+            default:                  renderWaveform<Waveform::saw>      (dest, numSamples); break;
+        }
+    }
+
+    /** RMS of the uncorrected waveform with its DC removed, for matching loudness. */
+    static float getRms (Waveform shape, float width = 0.5f) noexcept
+    {
+        switch (shape)
+        {
+            case Waveform::square:    return 1.0f;
+            case Waveform::pulse:     return 2.0f * std::sqrt (width * (1.0f - width));
+            case Waveform::saw:
+            case Waveform::triangle:
+            default:                  return 1.0f / std::sqrt (3.0f);
+        }
+    }
+
+private:
+    /** Samples rendered per pass, so the phases fit on the stack. */
+    static constexpr int chunkSize = 64;
+
+    static forcedinline float wrap (float t) noexcept    { return t - (float) (int) t; }
+
+    template <Waveform shape>
+    void renderWaveform (float* dest, int numSamples) noexcept
+    {
+        for (auto offset = 0; offset < numSamples; offset += chunkSize)
+            renderChunk<shape> (dest + offset, juce::jmin (chunkSize, numSamples - offset));
+    }
+
+    /** Works out every phase in the chunk first, draws the naive waveform
+        from them with no branches, then adds the residuals only around the
+        samples where an edge or corner was crossed.
+    */
+    template <Waveform shape>
+    void renderChunk (float* dest, int numSamples) noexcept
+    {
+        // [0] is the sample before the chunk and [numSamples + 1] the one after it
+        float phases[chunkSize + 2], dts[chunkSize + 2];
+        phases[0] = lastPhase;
+        dts[0] = 0.5f;
+
+        for (auto i = 1; i <= numSamples; ++i)
+        {
+            auto delta = phaseDelta * pitchRatio;
+
+            phases[i] = phase;
+
+            // the residuals overlap above this, where there is nothing left to save
+            dts[i] = juce::jmin (delta, 0.5f);
+
+            // a big enough bend can step more than a whole cycle
+            phase = wrap (phase + delta);
+            phaseDelta *= glideRatio;
+        }
+
+        phases[numSamples + 1] = phase;
+        dts[numSamples + 1] = juce::jmin (phaseDelta * pitchRatio, 0.5f);
+        lastPhase = phases[numSamples];
+
+        auto width = shape == Waveform::square ? 0.5f : pulseWidth;
+        auto dcOffset = 2.0f * width - 1.0f;
+        auto* p = phases + 1;
+
+        for (auto i = 0; i < numSamples; ++i)
+        {
+            if (shape == Waveform::saw)
+                dest[i] = 2.0f * p[i] - 1.0f;
+            else if (shape == Waveform::triangle)
+                dest[i] = 1.0f - 4.0f * std::abs (p[i] - 0.5f);
+            else
+                dest[i] = (p[i] < width ? 1.0f : -1.0f) - dcOffset;
+        }
+
+        if (shape == Waveform::saw)
+        {
+            addResiduals<false> (dest, numSamples, phases, dts, 0.0f, -1.0f);
+        }
+        else if (shape == Waveform::triangle)
+        {
+            addResiduals<true> (dest, numSamples, phases, dts, 0.0f, 4.0f);
+            addResiduals<true> (dest, numSamples, phases, dts, 0.5f, -4.0f);
+        }
+        else
+        {
+            addResiduals<false> (dest, numSamples, phases, dts, 0.0f, 1.0f);
+            addResiduals<false> (dest, numSamples, phases, dts, width, -1.0f);
+        }
+    }
+
+    /** Adds gain times the two-sample residual of a step (or, for a corner,
+        of a change of slope gain * dt) at every point where the phase passes
+        edge: on the sample after it, and on the one before when that is in
+        this chunk. A step of height 2 needs a gain of 1.
+    */
+    template <bool isCorner>
+    static void addResiduals (float* dest, int numSamples, const float* phases, const float* dts,
+                              float edge, float gain) noexcept
+    {
+        auto before = wrap (phases[0] + 1.0f - edge);
+
+        for (auto i = 1; i <= numSamples + 1; ++i)
+        {
+            auto after = wrap (phases[i] + 1.0f - edge);
+
+            if (after < before)
+            {
+                if (i <= numSamples && after < dts[i])
+                {
+                    auto t = after / dts[i];
+                    dest[i - 1] += gain * (isCorner ? dts[i] * -cube (t - 1.0f) / 3.0f
+                                                    : t + t - t * t - 1.0f);
+                }
+
+                if (i >= 2 && before > 1.0f - dts[i - 1])
+                {
+                    auto t = (before - 1.0f) / dts[i - 1];
+                    dest[i - 2] += gain * (isCorner ? dts[i - 1] * cube (t + 1.0f) / 3.0f
+                                                    : t * t + t + t + 1.0f);
+                }
+            }
+
+            before = after;
+        }
+    }
+
+    static forcedinline float cube (float x) noexcept    { return x * x * x; }
+
+    Waveform waveform = Waveform::saw;
+    float pulseWidth = 0.25f;
+    // as if the previous sample had just finished a cycle, so a note starts on its edge
+    static constexpr float justBelowOne = 1.0f - std::numeric_limits<float>::epsilon();
+
+    float phase = 0.0f, lastPhase = justBelowOne, phaseDelta = 0.0f, pitchRatio = 1.0f;
+    float targetDelta = 0.0f, glideRatio = 1.0f, segmentStartDelta = 0.0f;
+    int glideSamplesRemaining = 0, segmentLength = 0;
+};
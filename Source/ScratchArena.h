@@ -0,0 +1,103 @@
+/*
+  ==============================================================================
+
+    ScratchArena.h
+
+    A bump-pointer arena of 64-byte-aligned float blocks for temporary
+    buffers inside the audio callback. It is sized once in prepareToPlay and
+    reset at the start of every block, so the callback never touches the heap
+    and every block handed out is aligned for vector kernels.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+class ScratchArena
+{
+public:
+    static constexpr size_t alignment = 64;
+
+    ScratchArena() = default;
+
+    /** Bytes a block of numFloats takes up, including padding to the next one. */
+    static constexpr size_t getAlignedBytes (size_t numFloats) noexcept
+    {
+        return (numFloats * sizeof (float) + alignment - 1) & ~(alignment - 1);
+    }
+
+    /** Not real-time safe; call from prepareToPlay. Only ever grows. */
+    void prepare (size_t bytesNeeded)
+    {
+        bytesNeeded = getAlignedBytes ((bytesNeeded + sizeof (float) - 1) / sizeof (float));
+
+        if (bytesNeeded > capacity)
+        {
+            storage.allocate (bytesNeeded + alignment, false);
+            base = juce::snapPointerToAlignment (storage.get(), alignment);
+            capacity = bytesNeeded;
+        }
+
+        reset();
+    }
+
+    /** Hands everything back. Call at the start of each audio block. */
+    void reset() noexcept    { used = 0; }
+
+    /** Returns an aligned block of numFloats, or nullptr if the arena was sized
+        too small for this block, which is a bug in the caller's prepare().
+    */
+    float* allocate (int numFloats) noexcept
+    {
+        auto bytes = getAlignedBytes ((size_t) numFloats);
+
+        // counts what was asked for, so a request that didn't fit shows up too
+        highWaterMark = juce::jmax (highWaterMark, used + bytes);
+
+        if (used + bytes > capacity)
+        {
+            jassertfalse;
+            return nullptr;
+        }
+
+        auto* block = reinterpret_cast<float*> (base + used);
+        used += bytes;
+        return block;
+    }
+
+    /** Gives back everything allocated during its lifetime, so stages that run
+        one after another (such as voices) can share the same space.
+    */
+    class ScopedRewind
+    {
+    public:
+        explicit ScopedRewind (ScratchArena& arenaToRewind) noexcept
+            : arena (arenaToRewind), mark (arenaToRewind.used) {}
+
+        ~ScopedRewind() noexcept    { arena.used = mark; }
+
+    private:
+        ScratchArena& arena;
+        size_t mark;
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedRewind)
+    };
+
+    size_t getMemoryUsage() const noexcept     { return capacity > 0 ? capacity + alignment : 0; }
+    size_t getCapacity() const noexcept        { return capacity; }
+
+    /** The most any block has asked for at once, which is over getCapacity()
+        if the arena was ever sized too small.
+    */
+    size_t getHighWaterMark() const noexcept   { return highWaterMark; }
+
+private:
+    juce::HeapBlock<char> storage;
+    char* base = nullptr;
+    size_t capacity = 0, used = 0, highWaterMark = 0;
+
+    JUCE_DECLARE_NON_COPYABLE (ScratchArena)
+};
@@ -0,0 +1,487 @@
+/*
+  ==============================================================================
+
+    SessionRecorder.h
+
+    Captures the exact MIDI handed to the synth each block, with block sizes,
+    sample rate and a checksum of the synth's output, so a live glitch can be
+    replayed offline (see SessionReplay.h). The checksum is taken before a
+    playing sequence and the effects are mixed in: the sequence isn't logged,
+    so replay could never reproduce a block it had touched.
+
+    The audio thread only copies each block into a lock-free FIFO; a writer
+    thread drains it to disk. If the FIFO ever fills up, blocks are dropped
+    rather than blocking the audio thread, and a 'D' record marks the gap as
+    soon as there is room again, so replay knows it can't match what follows.
+
+    Log layout, host byte order, each field written on its own with no padding:
+        header:  int32 magic, int32 version
+        'P':     double sampleRate, int32 blockSize, then the settings as for 'S'
+        'S':     int32 voiceMode, double glideSeconds, int32 velocityCurve, int32 oscillator,
+                 float silenceFloorDb, int32 silentBlocks,
+                 double renderCacheMilliseconds, int32 renderCacheEntries,
+                 int32 mpeLowerMembers, int32 mpeUpperMembers,
+                 uint8 chorusEnabled, uint8 delayEnabled, double tempo, double delayBeats,
+                 float delayFeedback, float delayMix
+        'B':     int32 numSamples, int32 numEvents, uint32 synthChecksum,
+                 then per event: int32 samplePosition, int32 numBytes, bytes
+        'D':     int32 numDroppedBlocks
+
+    An 'S' record comes before the first block rendered with settings changed
+    since the last 'P' or 'S'. A block is only written if its 'S' was.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <tuple>
+
+//==============================================================================
+struct SessionLog
+{
+    static constexpr juce::int32 magic = 0x4c4e5953; // "SYNL"
+    static constexpr juce::int32 version = 10;
+
+    static constexpr char prepareRecord = 'P';
+    static constexpr char settingsRecord = 'S';
+    static constexpr char blockRecord = 'B';
+    static constexpr char droppedRecord = 'D';
+
+    /** No record, and so no single event, is bigger than this. */
+    static constexpr int maxRecordBytes = 1 << 16;
+
+    /** Everything besides the MIDI that shapes what the engine renders. */
+    struct Settings
+    {
+        juce::int32 voiceMode;
+        double glideSeconds;
+        juce::int32 velocityCurve, oscillator;
+        float silenceFloorDb;
+        juce::int32 silentBlocks;
+        double renderCacheMilliseconds;
+        juce::int32 renderCacheEntries;
+        juce::int32 mpeLowerMembers, mpeUpperMembers;
+        bool chorusEnabled, delayEnabled;
+        double tempo, delayBeats;
+        float delayFeedback, delayMix;
+
+        auto tie() const noexcept
+        {
+            return std::tie (voiceMode, glideSeconds, velocityCurve, oscillator, silenceFloorDb, silentBlocks,
+                             renderCacheMilliseconds, renderCacheEntries, mpeLowerMembers, mpeUpperMembers,
+                             chorusEnabled, delayEnabled, tempo, delayBeats, delayFeedback, delayMix);
+        }
+
+        bool operator== (const Settings& other) const noexcept    { return tie() == other.tie(); }
+        bool operator!= (const Settings& other) const noexcept    { return tie() != other.tie(); }
+
+        /** Calls visit with each field in log order, so the recorder and the
+            reader share one list.
+        */
+        template <typename SettingsType, typename Visitor>
+        static void forEachField (SettingsType& settings, Visitor&& visit)
+        {
+            visit (settings.voiceMode);
+            visit (settings.glideSeconds);
+            visit (settings.velocityCurve);
+            visit (settings.oscillator);
+            visit (settings.silenceFloorDb);
+            visit (settings.silentBlocks);
+            visit (settings.renderCacheMilliseconds);
+            visit (settings.renderCacheEntries);
+            visit (settings.mpeLowerMembers);
+            visit (settings.mpeUpperMembers);
+            visit (settings.chorusEnabled);
+            visit (settings.delayEnabled);
+            visit (settings.tempo);
+            visit (settings.delayBeats);
+            visit (settings.delayFeedback);
+            visit (settings.delayMix);
+        }
+    };
+
+    struct Prepare
+    {
+        double sampleRate;
+        juce::int32 blockSize;
+        Settings settings;
+    };
+
+    /** FNV-1a over the raw bits of every rendered sample. */
+    static juce::uint32 checksum (const juce::AudioSampleBuffer& buffer, int startSample, int numSamples) noexcept
+    {
+        juce::uint32 hash = 2166136261u;
+
+        for (auto channel = 0; channel < buffer.getNumChannels(); ++channel)
+        {
+            auto* samples = buffer.getReadPointer (channel, startSample);
+
+            for (auto i = 0; i < numSamples; ++i)
+            {
+                juce::uint32 bits;
+                std::memcpy (&bits, samples + i, sizeof (bits));
+                hash = (hash ^ bits) * 16777619u;
+            }
+        }
+
+        return hash;
+    }
+};
+
+//==============================================================================
+class SessionRecorder   : private juce::Thread
+{
+public:
+    explicit SessionRecorder (const juce::File& fileToWrite, int fifoBytes = 1 << 20)
+        : juce::Thread ("Session recorder"),
+          fifo (fifoBytes)
+    {
+        fifoData.allocate ((size_t) fifoBytes, true);
+        recordScratch.allocate ((size_t) SessionLog::maxRecordBytes, true);
+
+        fileToWrite.deleteFile();
+        stream = fileToWrite.createOutputStream();
+
+        if (stream != nullptr)
+        {
+            stream->writeInt (SessionLog::magic);
+            stream->writeInt (SessionLog::version);
+            startThread();
+        }
+    }
+
+    ~SessionRecorder() override
+    {
+        stopThread (2000);
+        drain();
+
+        // the audio thread has let go, so a gap at the very end can still be marked
+        writeDroppedRecord();
+        drain();
+    }
+
+    bool isRecording() const noexcept                   { return stream != nullptr; }
+    juce::int64 getNumDroppedBlocks() const noexcept    { return droppedBlocks; }
+    size_t getMemoryUsage() const noexcept              { return (size_t) fifo.getTotalSize() + (size_t) SessionLog::maxRecordBytes; }
+
+    //==============================================================================
+    /** Called from prepareToPlay, or before the recorder is handed to the audio thread. */
+    void recordPrepare (const SessionLog::Prepare& prepare) noexcept
+    {
+        if (! writeDroppedRecord())
+            return;
+
+        auto* dest = recordScratch.get();
+        *dest++ = SessionLog::prepareRecord;
+        dest = write (dest, prepare.sampleRate);
+        dest = write (dest, prepare.blockSize);
+        dest = writeSettings (dest, prepare.settings);
+
+        if (push ((int) (dest - recordScratch.get())))
+            lastSettings = prepare.settings;
+        else
+            dropBlock();  // replay can't be trusted past a lost prepare either
+    }
+
+    /** Audio thread: the MIDI exactly as passed to Synthesiser::renderNextBlock,
+        with positions made relative to startSample, the checksum of what the
+        synth rendered from it, and the settings the block was rendered with,
+        which are only written when they have changed. A block with more MIDI
+        than fits in a record, or whose settings couldn't be written, is
+        dropped and marked in the log.
+    */
+    void recordBlock (const juce::MidiBuffer& midi, int startSample, int numSamples, juce::uint32 synthChecksum,
+                      const SessionLog::Settings& settings) noexcept
+    {
+        if (! writeDroppedRecord())
+        {
+            dropBlock();
+            return;
+        }
+
+        if (settings != lastSettings)
+        {
+            auto* dest = recordScratch.get();
+            *dest++ = SessionLog::settingsRecord;
+            dest = writeSettings (dest, settings);
+
+            // lastSettings stays put, so the next block tries again
+            if (! push ((int) (dest - recordScratch.get())))
+            {
+                dropBlock();
+                return;
+            }
+
+            lastSettings = settings;
+        }
+
+        auto* dest = recordScratch.get();
+        auto* end = dest + SessionLog::maxRecordBytes;
+
+        *dest++ = SessionLog::blockRecord;
+        dest = write (dest, (juce::int32) numSamples);
+        auto* numEventsPosition = dest;
+        dest = write (dest, (juce::int32) 0);
+        dest = write (dest, synthChecksum);
+
+        juce::int32 numEvents = 0;
+
+        for (const auto metadata : midi)
+        {
+            if (end - dest < (std::ptrdiff_t) (2 * sizeof (juce::int32) + (size_t) metadata.numBytes))
+            {
+                dropBlock();
+                return;
+            }
+
+            dest = write (dest, (juce::int32) (metadata.samplePosition - startSample));
+            dest = write (dest, (juce::int32) metadata.numBytes);
+            std::memcpy (dest, metadata.data, (size_t) metadata.numBytes);
+            dest += metadata.numBytes;
+            ++numEvents;
+        }
+
+        write (numEventsPosition, numEvents);
+
+        if (! push ((int) (dest - recordScratch.get())))
+            dropBlock();
+    }
+
+private:
+    template <typename Type>
+    static char* write (char* dest, Type value) noexcept
+    {
+        std::memcpy (dest, &value, sizeof (value));
+        return dest + sizeof (value);
+    }
+
+    static char* write (char* dest, bool value) noexcept
+    {
+        return write (dest, (juce::uint8) (value ? 1 : 0));
+    }
+
+    static char* writeSettings (char* dest, const SessionLog::Settings& settings) noexcept
+    {
+        SessionLog::Settings::forEachField (settings, [&dest] (const auto& field) { dest = write (dest, field); });
+        return dest;
+    }
+
+    void dropBlock() noexcept
+    {
+        ++droppedBlocks;
+        ++unmarkedDrops;
+    }
+
+    /** Marks any blocks dropped since the last 'D' record. Returns false if
+        that is still owed, in which case nothing else may be written yet.
+    */
+    bool writeDroppedRecord() noexcept
+    {
+        if (unmarkedDrops == 0)
+            return true;
+
+        auto* dest = recordScratch.get();
+        *dest++ = SessionLog::droppedRecord;
+        dest = write (dest, unmarkedDrops);
+
+        if (! push ((int) (dest - recordScratch.get())))
+            return false;
+
+        unmarkedDrops = 0;
+        return true;
+    }
+
+    bool push (int numBytes) noexcept
+    {
+        if (fifo.getFreeSpace() < numBytes)
+            return false;
+
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite (numBytes, start1, size1, start2, size2);
+
+        std::memcpy (fifoData + start1, recordScratch.get(), (size_t) size1);
+        std::memcpy (fifoData + start2, recordScratch.get() + size1, (size_t) size2);
+
+        fifo.finishedWrite (size1 + size2);
+        return true;
+    }
+
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            drain();
+            wait (20);
+        }
+    }
+
+    void drain()
+    {
+        if (stream == nullptr)
+            return;
+
+        int start1, size1, start2, size2;
+        fifo.prepareToRead (fifo.getNumReady(), start1, size1, start2, size2);
+
+        stream->write (fifoData + start1, (size_t) size1);
+        stream->write (fifoData + start2, (size_t) size2);
+
+        fifo.finishedRead (size1 + size2);
+        stream->flush();
+    }
+
+    juce::AbstractFifo fifo;
+    juce::HeapBlock<char> fifoData, recordScratch;
+    std::unique_ptr<juce::FileOutputStream> stream;
+    std::atomic<juce::int64> droppedBlocks { 0 };
+    juce::int32 unmarkedDrops = 0;
+    SessionLog::Settings lastSettings {};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SessionRecorder)
+};
+
+//==============================================================================
+/** Reads back a log written by SessionRecorder, one record at a time. Every
+    length and count is checked against the limits the recorder writes with,
+    so a truncated or corrupted log ends in an error rather than garbage.
+*/
+class SessionLogReader
+{
+public:
+    explicit SessionLogReader (const juce::File& fileToRead)
+        : stream (fileToRead)
+    {
+        juce::int32 fileMagic = 0, fileVersion = 0;
+
+        valid = stream.openedOk()
+                 && read (fileMagic) && fileMagic == SessionLog::magic
+                 && read (fileVersion) && fileVersion == SessionLog::version;
+
+        eventData.resize ((size_t) SessionLog::maxRecordBytes);
+    }
+
+    bool isValid() const noexcept                   { return valid; }
+
+    /** Why readNext() last returned Record::error. */
+    const juce::String& getError() const noexcept   { return error; }
+
+    /** Blocks the recorder dropped, summed over the 'D' records read so far. */
+    juce::int64 getNumDroppedBlocks() const noexcept    { return droppedBlocks; }
+
+    enum class Record
+    {
+        prepare,
+        settings,
+        block,
+        dropped,
+        end,
+        error
+    };
+
+    /** Reads the next record into prepare, settings, or midi/numSamples/checksum.
+        Record::dropped means blocks are missing here, so nothing after it can
+        be expected to match.
+    */
+    Record readNext (SessionLog::Prepare& prepare, SessionLog::Settings& settings,
+                     juce::MidiBuffer& midi, int& numSamples, juce::uint32& checksum)
+    {
+        if (! valid || stream.isExhausted())
+            return Record::end;
+
+        auto type = stream.readByte();
+
+        if (type == SessionLog::prepareRecord)
+            return read (prepare.sampleRate) && read (prepare.blockSize) && readSettings (prepare.settings)
+                     && prepare.sampleRate > 0.0 && prepare.blockSize > 0
+                     ? Record::prepare : fail ("bad prepare record");
+
+        if (type == SessionLog::settingsRecord)
+            return readSettings (settings) ? Record::settings : fail ("bad settings record");
+
+        if (type == SessionLog::droppedRecord)
+        {
+            juce::int32 numDropped = 0;
+
+            if (! (read (numDropped) && numDropped > 0))
+                return fail ("bad dropped record");
+
+            droppedBlocks += numDropped;
+            return Record::dropped;
+        }
+
+        if (type != SessionLog::blockRecord)
+            return fail ("unknown record type " + juce::String ((int) type));
+
+        juce::int32 samples = 0, numEvents = 0;
+
+        if (! (read (samples) && read (numEvents) && read (checksum)))
+            return fail ("truncated block header");
+
+        // every event takes at least two int32s and a byte
+        if (samples <= 0 || numEvents < 0 || numEvents > SessionLog::maxRecordBytes / 9)
+            return fail ("bad block header");
+
+        numSamples = samples;
+        midi.clear();
+
+        for (auto i = 0; i < numEvents; ++i)
+        {
+            juce::int32 position = 0, numBytes = 0;
+
+            if (! (read (position) && read (numBytes)))
+                return fail ("truncated event");
+
+            if (position < 0 || position >= numSamples || numBytes <= 0 || numBytes > SessionLog::maxRecordBytes)
+                return fail ("bad event");
+
+            if (stream.read (eventData.data(), numBytes) != numBytes)
+                return fail ("truncated event data");
+
+            midi.addEvent (eventData.data(), numBytes, position);
+        }
+
+        return Record::block;
+    }
+
+private:
+    template <typename Type>
+    bool read (Type& value)
+    {
+        return stream.read (&value, (int) sizeof (value)) == (int) sizeof (value);
+    }
+
+    bool read (bool& value)
+    {
+        juce::uint8 byte = 0;
+
+        if (! read (byte) || byte > 1)
+            return false;
+
+        value = byte != 0;
+        return true;
+    }
+
+    bool readSettings (SessionLog::Settings& settings)
+    {
+        auto ok = true;
+        SessionLog::Settings::forEachField (settings, [this, &ok] (auto& field) { ok = ok && read (field); });
+        return ok;
+    }
+
+    Record fail (const juce::String& reason)
+    {
+        error = reason + " at byte " + juce::String (stream.getPosition());
+        valid = false;
+        return Record::error;
+    }
+
+    juce::FileInputStream stream;
+    std::vector<juce::uint8> eventData;
+    juce::String error;
+    juce::int64 droppedBlocks = 0;
+    bool valid = false;
+
+    JUCE_DECLARE_NON_COPYABLE (SessionLogReader)
+};
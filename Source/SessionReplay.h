@@ -0,0 +1,194 @@
+/*
+  ==============================================================================
+
+    SessionReplay.h
+
+    Re-drives an offline SynthAudioSource from a SessionRecorder log, block
+    for block, and checks what the synth rendered in each block against the
+    checksum captured live, before the effects. The effects still run, so
+    the optional wav sounds like the live output without any sequence that
+    was playing. Once the log says the recorder dropped blocks, the engine
+    state no longer follows the live one, so later blocks are rendered but
+    not compared. Run it with --replay=<log> [--output=<wav>]; see Main.cpp.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <iostream>
+#include "CommandLineOptions.h"
+#include "SessionRecorder.h"
+
+//==============================================================================
+class SessionReplay
+{
+public:
+    static constexpr int numOutputChannels = 2;
+
+    SessionReplay (const juce::File& logToReplay, const juce::File& wavToWrite)
+        : logFile (logToReplay), outputFile (wavToWrite)
+    {
+    }
+
+    /** Returns 0 if every block compared matched its live checksum, 1 otherwise. */
+    int run()
+    {
+        SessionLogReader reader (logFile);
+
+        if (! reader.isValid())
+        {
+            std::cout << "Not a session log: " << logFile.getFullPathName() << std::endl;
+            return 1;
+        }
+
+        juce::MidiKeyboardState keyboardState;
+        SynthAudioSource source (keyboardState);
+        juce::AudioSampleBuffer buffer;
+        juce::MidiBuffer midi;
+        std::unique_ptr<juce::AudioFormatWriter> writer;
+
+        SessionLog::Prepare prepare { 44100.0, 512, { (juce::int32) SineWaveSynth::VoiceMode::poly, 0.0,
+                                                      (juce::int32) SineWaveSound::VelocityCurve::linear,
+                                                      (juce::int32) SineWaveSound::Oscillator::wavetable, -80.0f, 4, 0.0, 0, 0, 0,
+                                                      false, false, 120.0, 0.75, 0.35f, 0.3f } };
+        auto settings = prepare.settings;
+        std::vector<double> renderTimes;
+        juce::int64 numBlocks = 0, numSamplesRendered = 0, mismatchedBlocks = 0, firstMismatch = -1, settingsChanges = 0;
+        juce::int64 firstUnverified = -1;
+        int minBlockSize = std::numeric_limits<int>::max(), maxBlockSize = 0;
+
+        for (;;)
+        {
+            int numSamples = 0;
+            juce::uint32 expectedChecksum = 0;
+            auto record = reader.readNext (prepare, settings, midi, numSamples, expectedChecksum);
+
+            if (record == SessionLogReader::Record::end)
+                break;
+
+            if (record == SessionLogReader::Record::error)
+            {
+                std::cout << "Corrupt session log after " << numBlocks << " blocks: " << reader.getError() << std::endl;
+                return 1;
+            }
+
+            if (record == SessionLogReader::Record::prepare)
+            {
+                source.prepareToPlay (prepare.blockSize, prepare.sampleRate);
+                applySettings (source, prepare.settings);
+
+                if (outputFile != juce::File() && writer == nullptr)
+                    writer = createWriter (prepare.sampleRate);
+
+                continue;
+            }
+
+            if (record == SessionLogReader::Record::settings)
+            {
+                applySettings (source, settings);
+                ++settingsChanges;
+                continue;
+            }
+
+            if (record == SessionLogReader::Record::dropped)
+            {
+                if (firstUnverified < 0)
+                    firstUnverified = numBlocks;
+
+                continue;
+            }
+
+            buffer.setSize (numOutputChannels, numSamples, false, false, true);
+
+            auto startTicks = juce::Time::getHighResolutionTicks();
+            auto checksum = source.renderRecordedBlock (juce::AudioSourceChannelInfo (buffer), midi);
+            renderTimes.push_back (juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks() - startTicks));
+
+            if (firstUnverified < 0 && checksum != expectedChecksum)
+            {
+                if (firstMismatch < 0)
+                    firstMismatch = numBlocks;
+
+                ++mismatchedBlocks;
+            }
+
+            if (writer != nullptr)
+                writer->writeFromAudioSampleBuffer (buffer, 0, numSamples);
+
+            ++numBlocks;
+            numSamplesRendered += numSamples;
+            minBlockSize = juce::jmin (minBlockSize, numSamples);
+            maxBlockSize = juce::jmax (maxBlockSize, numSamples);
+        }
+
+        if (numBlocks == 0)
+        {
+            std::cout << "Log contains no blocks" << std::endl;
+            return 1;
+        }
+
+        std::sort (renderTimes.begin(), renderTimes.end());
+        auto percentile = [&] (double p) { return renderTimes[(size_t) (p * (double) (renderTimes.size() - 1))]; };
+
+        std::cout << "sample rate:        " << prepare.sampleRate << std::endl
+                  << "blocks:             " << numBlocks << " (" << numSamplesRendered << " samples)" << std::endl
+                  << "block sizes:        " << minBlockSize << " - " << maxBlockSize << std::endl
+                  << "settings changes:   " << settingsChanges << std::endl
+                  << "render us/block:    median " << percentile (0.5) * 1.0e6
+                  << ", p99 " << percentile (0.99) * 1.0e6
+                  << ", max " << renderTimes.back() * 1.0e6 << std::endl
+                  << "mismatched blocks:  " << mismatchedBlocks;
+
+        if (firstMismatch >= 0)
+            std::cout << " (first at block " << firstMismatch << ")";
+
+        std::cout << std::endl;
+
+        if (firstUnverified >= 0)
+            std::cout << "unverified blocks:  " << numBlocks - firstUnverified << " (the recorder dropped "
+                      << reader.getNumDroppedBlocks() << ", the first just before block " << firstUnverified << ")" << std::endl;
+
+        return mismatchedBlocks == 0 ? 0 : 1;
+    }
+
+private:
+    static void applySettings (SynthAudioSource& source, const SessionLog::Settings& settings)
+    {
+        source.getSynth().setVoiceMode ((SineWaveSynth::VoiceMode) settings.voiceMode);
+        source.getSynth().setGlideTime (settings.glideSeconds);
+        source.getSynth().setVelocityCurve ((SineWaveSound::VelocityCurve) settings.velocityCurve);
+        source.getSynth().setOscillator (source.getSound(), (SineWaveSound::Oscillator) settings.oscillator);
+        source.getSynth().setSilenceRelease (settings.silenceFloorDb, settings.silentBlocks);
+        source.getSynth().setRenderCache (settings.renderCacheMilliseconds, settings.renderCacheEntries);
+        source.getSynth().setMpeZones (settings.mpeLowerMembers, settings.mpeUpperMembers);
+
+        auto& effects = source.getMasterEffects();
+        effects.setChorusEnabled (settings.chorusEnabled);
+        effects.setDelayEnabled (settings.delayEnabled);
+        effects.setDelayBeats (settings.delayBeats);
+        effects.setDelayFeedback (settings.delayFeedback);
+        effects.setDelayMix (settings.delayMix);
+        source.setTempo (settings.tempo);
+    }
+
+    std::unique_ptr<juce::AudioFormatWriter> createWriter (double sampleRate)
+    {
+        outputFile.deleteFile();
+
+        if (auto stream = outputFile.createOutputStream())
+        {
+            std::unique_ptr<juce::AudioFormatWriter> result (juce::WavAudioFormat().createWriterFor (stream.get(), sampleRate,
+                                                                                                      numOutputChannels, 24, {}, 0));
+            if (result != nullptr)
+                stream.release();  // the writer owns it now
+
+            return result;
+        }
+
+        return {};
+    }
+
+    juce::File logFile, outputFile;
+};
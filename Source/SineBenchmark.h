@@ -0,0 +1,137 @@
+/*
+  ==============================================================================
+
+    SineBenchmark.h
+
+    Checks FastSine's error against double-precision std::sin and times it
+    against std::sin on a frequency-modulated phase, sample by sample and a
+    block at a time. Run it with --benchmark-sine [--seconds=N]
+    [--error-points=N]; see Main.cpp.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <iostream>
+#include "CommandLineOptions.h"
+
+//==============================================================================
+class SineBenchmark
+{
+public:
+    struct Options
+    {
+        double secondsPerRun = 10.0;
+        double sampleRate = 48000.0;
+        int blockSize = 512;
+        int errorTestPoints = 10000000;
+
+        static Options fromCommandLine (const juce::StringArray& args)
+        {
+            Options o;
+            o.secondsPerRun   = getCommandLineOption (args, "--seconds", o.secondsPerRun);
+            o.sampleRate      = getCommandLineOption (args, "--sample-rate", o.sampleRate);
+            o.blockSize       = getCommandLineOption (args, "--block-size", o.blockSize);
+            o.errorTestPoints = getCommandLineOption (args, "--error-points", o.errorTestPoints);
+            return o;
+        }
+    };
+
+    explicit SineBenchmark (Options optionsToUse)  : options (std::move (optionsToUse)) {}
+
+    /** Returns 1 if the error is over the bound documented in FastSine.h. */
+    int run()
+    {
+        auto sinError = measureError (false);
+        auto cosError = measureError (true);
+
+        std::cout << "max error sin:  " << sinError << " (" << juce::Decibels::gainToDecibels (sinError, -200.0) << " dB)" << std::endl
+                  << "max error cos:  " << cosError << " (" << juce::Decibels::gainToDecibels (cosError, -200.0) << " dB)" << std::endl;
+
+        auto phases = createModulatedPhases();
+        std::vector<float> output ((size_t) options.blockSize);
+
+        auto stdSin = measureSpeed (phases, output, [] (const float* p, float* dest, int n)
+        {
+            for (auto i = 0; i < n; ++i)
+                dest[i] = (float) std::sin (juce::MathConstants<float>::twoPi * p[i]);
+        });
+
+        auto fastScalar = measureSpeed (phases, output, [] (const float* p, float* dest, int n)
+        {
+            for (auto i = 0; i < n; ++i)
+                dest[i] = FastSine::sinTurns (p[i]);
+        });
+
+        auto fastBlock = measureSpeed (phases, output, [] (const float* p, float* dest, int n)
+        {
+            FastSine::sinTurns (p, dest, n);
+        });
+
+        std::cout << "std::sin:       " << stdSin << " ns/sample" << std::endl
+                  << "FastSine:       " << fastScalar << " ns/sample" << std::endl
+                  << "FastSine block: " << fastBlock << " ns/sample" << std::endl;
+
+        return sinError <= 7.5e-7 && cosError <= 1.4e-6 ? 0 : 1;
+    }
+
+private:
+    double measureError (bool cosine) const
+    {
+        auto maxError = 0.0;
+
+        for (auto i = 0; i <= options.errorTestPoints; ++i)
+        {
+            auto phase = -2.0f + 4.0f * (float) ((double) i / options.errorTestPoints);
+            auto angle = juce::MathConstants<double>::twoPi * phase;
+
+            auto approximate = cosine ? FastSine::cosTurns (phase) : FastSine::sinTurns (phase);
+            auto exact = cosine ? std::cos (angle) : std::sin (angle);
+
+            maxError = juce::jmax (maxError, std::abs (approximate - exact));
+        }
+
+        return maxError;
+    }
+
+    /** One block of an A4 carrier under heavy per-sample FM, wrapped to a turn. */
+    std::vector<float> createModulatedPhases() const
+    {
+        std::vector<float> phases ((size_t) options.blockSize);
+        auto phase = 0.0, modulatorPhase = 0.0;
+
+        for (auto& p : phases)
+        {
+            p = (float) phase;
+
+            auto frequency = 440.0 * (1.0 + 0.9 * std::sin (juce::MathConstants<double>::twoPi * modulatorPhase));
+            phase += frequency / options.sampleRate;
+            phase -= std::floor (phase);
+            modulatorPhase += 110.0 / options.sampleRate;
+        }
+
+        return phases;
+    }
+
+    template <typename Kernel>
+    double measureSpeed (const std::vector<float>& phases, std::vector<float>& output, Kernel kernel) const
+    {
+        auto numBlocks = juce::jmax (1, (int) (options.secondsPerRun * options.sampleRate) / options.blockSize);
+        auto startTicks = juce::Time::getHighResolutionTicks();
+
+        for (auto block = 0; block < numBlocks; ++block)
+            kernel (phases.data(), output.data(), options.blockSize);
+
+        auto elapsed = juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks() - startTicks);
+
+        // keep the optimiser from discarding the render
+        volatile auto sink = output[0];
+        juce::ignoreUnused (sink);
+
+        return elapsed * 1.0e9 / ((double) numBlocks * options.blockSize);
+    }
+
+    Options options;
+};
@@ -0,0 +1,281 @@
+/*
+  ==============================================================================
+
+    SoakTest.h
+
+    Plays randomised MIDI through a SynthAudioSource for a long stretch of
+    audio time, as fast as it will render, sampling resident memory, heap
+    allocations made inside the audio callback and block timing percentiles
+    once per window. Fails if memory or timing drift upwards between the
+    first and last window, or if the callback allocates at all. Run it with
+    --soak [--seconds=N]; see Main.cpp.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <iostream>
+#include "CommandLineOptions.h"
+
+#if JUCE_LINUX
+ #include <unistd.h>
+#elif JUCE_MAC
+ #include <mach/mach.h>
+#endif
+
+/** When enabled, Main.cpp replaces the global operator new so allocations can
+    be counted. It costs one relaxed atomic increment per allocation, so only
+    the Debug configurations define it; elsewhere --soak reports the callback
+    allocations as n/a and doesn't check them.
+*/
+#ifndef SYNTH_COUNT_ALLOCATIONS
+ #define SYNTH_COUNT_ALLOCATIONS 0
+#endif
+
+//==============================================================================
+struct ProcessMemory
+{
+    /** Heap allocations made inside a ScopedCount. Other threads, such as the
+        wavetable builder or the session recorder's writer, aren't counted.
+    */
+    static std::atomic<juce::int64>& getAllocationCount() noexcept
+    {
+        static std::atomic<juce::int64> count { 0 };
+        return count;
+    }
+
+    /** Counts the allocations the current thread makes while it exists. */
+    struct ScopedCount
+    {
+        ScopedCount() noexcept     { isCountingThisThread() = true; }
+        ~ScopedCount() noexcept    { isCountingThisThread() = false; }
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedCount)
+    };
+
+    /** Called by the replacement operator new in Main.cpp. */
+    static void countAllocation() noexcept
+    {
+        if (isCountingThisThread())
+            getAllocationCount().fetch_add (1, std::memory_order_relaxed);
+    }
+
+    static bool& isCountingThisThread() noexcept
+    {
+        static thread_local bool counting = false;
+        return counting;
+    }
+
+    /** Resident set size in bytes, or -1 where we don't know how to ask. */
+    static juce::int64 getResidentBytes()
+    {
+       #if JUCE_LINUX
+        long pages = 0, residentPages = 0;
+
+        if (auto* statm = fopen ("/proc/self/statm", "r"))
+        {
+            auto numRead = fscanf (statm, "%ld %ld", &pages, &residentPages);
+            fclose (statm);
+
+            if (numRead == 2)
+                return (juce::int64) residentPages * (juce::int64) sysconf (_SC_PAGESIZE);
+        }
+
+        return -1;
+       #elif JUCE_MAC
+        mach_task_basic_info info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+
+        if (task_info (mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) == KERN_SUCCESS)
+            return (juce::int64) info.resident_size;
+
+        return -1;
+       #else
+        return -1;
+       #endif
+    }
+};
+
+//==============================================================================
+class SoakTest
+{
+public:
+    struct Options
+    {
+        double seconds = 3600.0;
+        double windowSeconds = 60.0;
+        double sampleRate = 48000.0;
+        int blockSize = 256;
+        double eventsPerSecond = 200.0;
+
+        /** Allowed growth from the first window to the last. */
+        juce::int64 maxResidentGrowthBytes = 1024 * 1024;
+        double maxTimingGrowth = 1.5;
+
+        static Options fromCommandLine (const juce::StringArray& args)
+        {
+            Options o;
+            o.seconds         = getCommandLineOption (args, "--seconds", o.seconds);
+            o.windowSeconds   = getCommandLineOption (args, "--window", o.windowSeconds);
+            o.sampleRate      = getCommandLineOption (args, "--sample-rate", o.sampleRate);
+            o.blockSize       = getCommandLineOption (args, "--block-size", o.blockSize);
+            o.eventsPerSecond = getCommandLineOption (args, "--rate", o.eventsPerSecond);
+            return o;
+        }
+    };
+
+    explicit SoakTest (Options optionsToUse)  : options (std::move (optionsToUse)) {}
+
+    /** Prints one line per window and returns 0 if nothing drifted. */
+    int run()
+    {
+        juce::MidiKeyboardState keyboardState;
+        SynthAudioSource source (keyboardState);
+        juce::AudioSampleBuffer buffer (2, options.blockSize);
+
+        source.prepareToPlay (options.blockSize, options.sampleRate);
+
+        auto& collector = *source.getMidiCollector();
+        auto blockSeconds = options.blockSize / options.sampleRate;
+        auto blocksPerWindow = juce::jmax (1, (int) (options.windowSeconds / blockSeconds));
+        auto numWindows = juce::jmax (2, (int) (options.seconds / options.windowSeconds));
+        auto eventsPerBlock = options.eventsPerSecond * blockSeconds;
+        auto eventBudget = 0.0;
+
+        std::vector<Window> windows;
+        std::vector<double> renderTimes ((size_t) blocksPerWindow);
+        auto wallClockStart = juce::Time::getMillisecondCounterHiRes();
+
+        std::cout << "window,audio_seconds,rss_kb,callback_allocations,engine_bytes,p50_us,p99_us,max_us" << std::endl;
+
+        for (auto window = 0; window < numWindows; ++window)
+        {
+            juce::int64 callbackAllocations = 0;
+
+            for (auto block = 0; block < blocksPerWindow; ++block)
+            {
+                for (eventBudget += eventsPerBlock; eventBudget >= 1.0; eventBudget -= 1.0)
+                    collector.addMessageToQueue (nextMessage().withTimeStamp (juce::Time::getMillisecondCounterHiRes() * 0.001));
+
+                auto allocationsBefore = ProcessMemory::getAllocationCount().load();
+                auto startTicks = juce::Time::getHighResolutionTicks();
+
+                {
+                    const ProcessMemory::ScopedCount count;
+                    source.getNextAudioBlock (juce::AudioSourceChannelInfo (buffer));
+                }
+
+                renderTimes[(size_t) block] = juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks() - startTicks);
+                callbackAllocations += ProcessMemory::getAllocationCount().load() - allocationsBefore;
+            }
+
+            std::sort (renderTimes.begin(), renderTimes.end());
+
+            Window w;
+            w.residentBytes = ProcessMemory::getResidentBytes();
+            w.callbackAllocations = callbackAllocations;
+            w.engineBytes = (juce::int64) source.getMemoryUsage().getTotal();
+            w.p50 = renderTimes[renderTimes.size() / 2];
+            w.p99 = renderTimes[(size_t) (0.99 * (double) (renderTimes.size() - 1))];
+            w.max = renderTimes.back();
+            windows.push_back (w);
+
+            std::cout << window << ',' << (window + 1) * blocksPerWindow * blockSeconds << ','
+                      << (w.residentBytes >= 0 ? juce::String (w.residentBytes / 1024) : juce::String ("n/a")) << ','
+                     #if SYNTH_COUNT_ALLOCATIONS
+                      << w.callbackAllocations << ','
+                     #else
+                      << "n/a" << ','
+                     #endif
+                      << w.engineBytes << ','
+                      << w.p50 * 1.0e6 << ',' << w.p99 * 1.0e6 << ',' << w.max * 1.0e6 << std::endl;
+        }
+
+        auto wallClockSeconds = (juce::Time::getMillisecondCounterHiRes() - wallClockStart) * 0.001;
+        std::cout << "rendered " << numWindows * blocksPerWindow * blockSeconds << " s of audio in "
+                  << wallClockSeconds << " s" << std::endl;
+
+        return checkForDrift (windows) ? 0 : 1;
+    }
+
+private:
+    struct Window
+    {
+        juce::int64 residentBytes, callbackAllocations, engineBytes;
+        double p50, p99, max;
+    };
+
+    /** Compares the last window against the second: the first one includes
+        warm-up such as the first touch of every wavetable page. Allocations
+        in the callback aren't a drift: a single one in any window fails.
+    */
+    bool checkForDrift (const std::vector<Window>& windows) const
+    {
+        const auto& first = windows[windows.size() > 2 ? 1 : 0];
+        const auto& last = windows.back();
+        auto passed = true;
+
+        auto check = [&passed] (bool ok, const char* what)
+        {
+            if (! ok)
+            {
+                std::cout << "FAILED: " << what << std::endl;
+                passed = false;
+            }
+        };
+
+        if (first.residentBytes >= 0 && last.residentBytes >= 0)
+            check (last.residentBytes - first.residentBytes <= options.maxResidentGrowthBytes, "resident memory grew");
+
+       #if SYNTH_COUNT_ALLOCATIONS
+        juce::int64 callbackAllocations = 0;
+
+        for (auto& w : windows)
+            callbackAllocations += w.callbackAllocations;
+
+        check (callbackAllocations == 0, "allocations in the audio callback");
+       #endif
+
+        check (last.engineBytes <= first.engineBytes, "engine memory grew");
+        check (last.p99 <= first.p99 * options.maxTimingGrowth, "p99 block time grew");
+
+        return passed;
+    }
+
+    /** Notes, releases, CCs and pitch bends in roughly 4:4:1:1 proportions. */
+    juce::MidiMessage nextMessage()
+    {
+        auto choice = random.nextInt (10);
+
+        if (choice < 4 || (choice < 8 && numSounding == 0))
+        {
+            auto note = 24 + random.nextInt (84);
+
+            if (numSounding < (int) sounding.size())
+                sounding[(size_t) numSounding++] = note;
+
+            return juce::MidiMessage::noteOn (1, note, (juce::uint8) (1 + random.nextInt (127)));
+        }
+
+        if (choice < 8)
+        {
+            auto index = random.nextInt (numSounding);
+            auto note = sounding[(size_t) index];
+            sounding[(size_t) index] = sounding[(size_t) --numSounding];
+
+            return juce::MidiMessage::noteOff (1, note);
+        }
+
+        if (choice < 9)
+            return juce::MidiMessage::controllerEvent (1, 1 + random.nextInt (100), random.nextInt (128));
+
+        return juce::MidiMessage::pitchWheel (1, random.nextInt (16384));
+    }
+
+    Options options;
+    juce::Random random { 4321 };
+    std::array<int, 256> sounding;
+    int numSounding = 0;
+};
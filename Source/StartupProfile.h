@@ -0,0 +1,97 @@
+/*
+  ==============================================================================
+
+    StartupProfile.h
+
+    Timestamps for the stages of launching the app, from static
+    initialisation to the first audio block, printed as a breakdown with
+    --profile-startup; see Main.cpp. Until it's enabled, marking a stage
+    costs one flag check.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <iostream>
+
+//==============================================================================
+class StartupProfile
+{
+public:
+    /** The clock starts the first time this is called, which Main.cpp makes
+        happen during static initialisation.
+    */
+    static StartupProfile& getInstance()
+    {
+        static StartupProfile instance;
+        return instance;
+    }
+
+    /** Message thread, before the first mark(). */
+    void setEnabled (bool shouldBeEnabled) noexcept     { enabled = shouldBeEnabled; }
+    bool isEnabled() const noexcept                     { return enabled; }
+
+    /** Message thread. Ends a stage that began at the previous mark. */
+    void mark (const char* stage)
+    {
+        if (enabled)
+            stages.push_back ({ stage, juce::Time::getMillisecondCounterHiRes() });
+    }
+
+    /** Audio thread, every block; real-time safe. Only the first call counts. */
+    void markFirstAudio() noexcept
+    {
+        if (enabled && firstAudio.load (std::memory_order_relaxed) == 0.0)
+        {
+            auto expected = 0.0;
+            firstAudio.compare_exchange_strong (expected, juce::Time::getMillisecondCounterHiRes());
+        }
+    }
+
+    bool hasAudioStarted() const noexcept               { return firstAudio.load() != 0.0; }
+
+    /** One line per stage with its duration and the time since the clock
+        started, in the order they finished. The first audio block can land
+        among the stages, as the device starts before the window is shown.
+    */
+    void print() const
+    {
+        auto all = stages;
+
+        if (hasAudioStarted())
+            all.push_back ({ "first audio block", firstAudio.load() });
+        else
+            all.push_back ({ "no audio block yet", juce::Time::getMillisecondCounterHiRes() });
+
+        std::stable_sort (all.begin(), all.end(), [] (const Stage& a, const Stage& b) { return a.time < b.time; });
+
+        std::cout << "startup profile (ms):" << std::endl;
+        auto previous = origin;
+
+        for (auto& stage : all)
+        {
+            std::cout << "  " << juce::String (stage.name).paddedRight (' ', 24)
+                      << juce::String (stage.time - previous, 1).paddedLeft (' ', 9)
+                      << juce::String (stage.time - origin, 1).paddedLeft (' ', 9) << std::endl;
+            previous = stage.time;
+        }
+    }
+
+private:
+    StartupProfile() = default;
+
+    struct Stage
+    {
+        const char* name;
+        double time;
+    };
+
+    const double origin = juce::Time::getMillisecondCounterHiRes();
+    bool enabled = false;
+    std::vector<Stage> stages;
+    std::atomic<double> firstAudio { 0.0 };
+
+    JUCE_DECLARE_NON_COPYABLE (StartupProfile)
+};
@@ -1,319 +1,2598 @@
-/*
-  ==============================================================================
-
-   This file is part of the JUCE tutorials.
-   Copyright (c) 2020 - Raw Material Software Limited
-
-   The code included in this file is provided under the terms of the ISC license
-   http://www.isc.org/downloads/software-support-policy/isc-license. Permission
-   To use, copy, modify, and/or distribute this software for any purpose with or
-   without fee is hereby granted provided that the above copyright notice and
-   this permission notice appear in all copies.
-
-   THE SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTY, AND ALL WARRANTIES,
-   WHETHER EXPRESSED OR IMPLIED, INCLUDING MERCHANTABILITY AND FITNESS FOR
-   PURPOSE, ARE DISCLAIMED.
-
-  ==============================================================================
-*/
-
-/*******************************************************************************
- The block below describes the properties of this PIP. A PIP is a short snippet
- of code that can be read by the Projucer and used to generate a JUCE project.
-
- BEGIN_JUCE_PIP_METADATA
-
- name:             SynthUsingMidiInputTutorial
- version:          1.0.0
- vendor:           JUCE
- website:          http://juce.com
- description:      Synthesiser with midi input.
-
- dependencies:     juce_audio_basics, juce_audio_devices, juce_audio_formats,
-                   juce_audio_processors, juce_audio_utils, juce_core,
-                   juce_data_structures, juce_events, juce_graphics,
-                   juce_gui_basics, juce_gui_extra
- exporters:        xcode_mac, vs2019, linux_make
-
- type:             Component
- mainClass:        MainContentComponent
-
- useLocalCopy:     1
-
- END_JUCE_PIP_METADATA
-
-*******************************************************************************/
-#include <string>
-
-#pragma once
-//==============================================================================
-class WavetableOscillator
-{
-public:
-	WavetableOscillator (const juce::AudioSampleBuffer& wavetableToUse)
-		: wavetable (wavetableToUse),
-		tableSize (wavetable.getNumSamples() - 1)
-	{
-		jassert (wavetable.getNumChannels() == 1);
-	}
-	
-	void setFrequency (float frequency, float sampleRate)
-	{
-		auto tableSizeOverSampleRate = (float) tableSize / sampleRate;
-		tableDelta = frequency * tableSizeOverSampleRate;
-	}
-	
-	forcedinline float getNextSample() noexcept
-	{
-		auto index0 = (unsigned int) currentIndex;
-		auto index1 = index0 + 1;
-		
-		//auto frac = currentIndex - (float) index0;
-		
-		auto* table = wavetable.getReadPointer (0);
-		auto value0 = table[index0];
-		auto value1 = table[index1];
-		
-		auto currentSample = value0 + 1 * (value1 - value0);
-		
-		if ((currentIndex += tableDelta) > (float) tableSize)
-			currentIndex -= (float) tableSize;
-		
-		return currentSample;
-	}
-	
-private:
-	const juce::AudioSampleBuffer& wavetable;
-	const int tableSize;
-	float currentIndex = 0.0f, tableDelta = 0.0f;
-};
-
-//==============================================================================
-struct SineWaveSound   : public juce::SynthesiserSound
-{
-
-    SineWaveSound() {
-		createWavetable();
-	}
-
-    bool appliesToNote    (int) override        { return true; }
-    bool appliesToChannel (int) override        { return true; }
-	juce::AudioSampleBuffer *getWaveTable() { return &waveTable; }
-	
-private:
-	void createWavetable()
-	{
-		waveTable.setSize (1, (int) tableSize + 1);
-		waveTable.clear();
-	
-		auto* samples = waveTable.getWritePointer (0);
-
-		int harmonics[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
-		//float harmonicWeights[] = { 0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f };
-		
-		//jassert (juce::numElementsInArray (harmonics) == juce::numElementsInArray (harmonicWeights));
-		
-		for (auto harmonic = 0; harmonic < juce::numElementsInArray (harmonics); ++harmonic)
-		{
-			auto angleDelta = juce::MathConstants<double>::twoPi / (double) (tableSize - 1) * harmonics[harmonic];
-			auto currentAngle = 0.0;
-
-			for (unsigned int i = 0; i < tableSize; ++i)
-			{
-				auto sample = std::sin (currentAngle);
-				samples[i] += (float) sample / (harmonic + 1);
-				currentAngle += angleDelta;
-			}
-			samples[tableSize] = samples[0];
-			}
-	}
-
-	juce::AudioSampleBuffer waveTable;
-	const unsigned int tableSize = 1 << 24;
-	
-};
-
-//==============================================================================
-struct SineWaveVoice   : public juce::SynthesiserVoice
-{
-    SineWaveVoice() {}
-
-    bool canPlaySound (juce::SynthesiserSound* sound) override
-    {
-        return dynamic_cast<SineWaveSound*> (sound) != nullptr;
-    }
-
-    void startNote (int midiNoteNumber, float velocity,
-                    juce::SynthesiserSound* sound, int /*currentPitchWheelPosition*/) override
-    {
-        level = velocity * 0.025;
-        tailOff = 0.0;
-		
-		auto sineWaveSound = dynamic_cast<SineWaveSound*> (sound);
-		juce::AudioSampleBuffer *waveTable = sineWaveSound->getWaveTable();
-		
-		osc = new WavetableOscillator(*waveTable);
-
-        auto cyclesPerSecond = juce::MidiMessage::getMidiNoteInHertz (midiNoteNumber);
-
-		osc->setFrequency ((float) cyclesPerSecond, (float) getSampleRate());
-		notePlaying = true;
-    }
-
-    void stopNote (float /*velocity*/, bool allowTailOff) override
-    {
-        if (allowTailOff)
-        {
-            if (tailOff == 0.0)
-                tailOff = 1.0;
-        }
-        else
-        {
-            clearCurrentNote();
-			notePlaying = false;
-        }
-    }
-
-    void pitchWheelMoved (int) override      {}
-    void controllerMoved (int, int) override {}
-
-    void renderNextBlock (juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples) override
-    {
-		if (notePlaying) {
-			if (tailOff > 0.0)
-			{
-				while (--numSamples >= 0)
-				{
-					auto currentSample = osc->getNextSample() * level * tailOff;
-	
-					for (auto i = outputBuffer.getNumChannels(); --i >= 0;)
-						outputBuffer.addSample (i, startSample, currentSample);
-
-					++startSample;
-
-					tailOff *= 0.99;
-					if (tailOff <= 0.005)
-					{
-						clearCurrentNote();
-						notePlaying = false;
-						break;
-					}
-				}
-			}
-			else
-			{
-				while (--numSamples >= 0)
-				{
-					auto currentSample = osc->getNextSample() * level;
-					for (auto i = outputBuffer.getNumChannels(); --i >= 0;)
-						outputBuffer.addSample (i, startSample, currentSample);
-					++startSample;
-				}
-			}
-		}
-    }
-
-private:
-    double level = 0.0, tailOff = 0.0;
-	bool notePlaying = false;
-	WavetableOscillator *osc;
-};
-
-//==============================================================================
-class SynthAudioSource   : public juce::AudioSource
-{
-public:
-    SynthAudioSource (juce::MidiKeyboardState& keyState)
-        : keyboardState (keyState)
-    {
-        for (auto i = 0; i < 4; ++i)
-            synth.addVoice (new SineWaveVoice());
-
-        synth.addSound (new SineWaveSound());
-    }
-
-    void setUsingSineWaveSound()
-    {
-        synth.clearSounds();
-    }
-
-    void prepareToPlay (int /*samplesPerBlockExpected*/, double sampleRate) override
-    {
-        synth.setCurrentPlaybackSampleRate (sampleRate);
-    }
-
-    void releaseResources() override {}
-
-    void getNextAudioBlock (const juce::AudioSourceChannelInfo& bufferToFill) override
-    {
-        bufferToFill.clearActiveBufferRegion();
-
-        juce::MidiBuffer incomingMidi;
-        keyboardState.processNextMidiBuffer (incomingMidi, bufferToFill.startSample,
-                                             bufferToFill.numSamples, true);
-
-        synth.renderNextBlock (*bufferToFill.buffer, incomingMidi,
-                               bufferToFill.startSample, bufferToFill.numSamples);
-    }
-
-private:
-    juce::MidiKeyboardState& keyboardState;
-    juce::Synthesiser synth;
-};
-
-//==============================================================================
-class MainContentComponent   : public juce::AudioAppComponent,
-                               private juce::Timer
-{
-public:
-    MainContentComponent()
-        : synthAudioSource  (keyboardState),
-          keyboardComponent (keyboardState, juce::MidiKeyboardComponent::horizontalKeyboard)
-    {
-        addAndMakeVisible (keyboardComponent);
-        setAudioChannels (0, 2);
-
-        setSize (600, 160);
-        startTimer (400);
-    }
-
-    ~MainContentComponent() override
-    {
-        shutdownAudio();
-    }
-
-    void resized() override
-    {
-        keyboardComponent.setBounds (10, 10, getWidth() - 20, getHeight() - 20);
-    }
-
-    void prepareToPlay (int samplesPerBlockExpected, double sampleRate) override
-    {
-        synthAudioSource.prepareToPlay (samplesPerBlockExpected, sampleRate);
-    }
-
-    void getNextAudioBlock (const juce::AudioSourceChannelInfo& bufferToFill) override
-    {
-        synthAudioSource.getNextAudioBlock (bufferToFill);
-    }
-
-    void releaseResources() override
-    {
-        synthAudioSource.releaseResources();
-    }
-
-private:
-    void timerCallback() override
-    {
-		keyboardComponent.setKeyPressBaseOctave(4);
-        keyboardComponent.grabKeyboardFocus();
-        stopTimer();
-    }
-
-    //==========================================================================
-    juce::MidiKeyboardState keyboardState;
-    SynthAudioSource synthAudioSource;
-    juce::MidiKeyboardComponent keyboardComponent;
-
-    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MainContentComponent)
-};
+/*
+  ==============================================================================
+
+   This file is part of the JUCE tutorials.
+   Copyright (c) 2020 - Raw Material Software Limited
+
+   The code included in this file is provided under the terms of the ISC license
+   http://www.isc.org/downloads/software-support-policy/isc-license. Permission
+   To use, copy, modify, and/or distribute this software for any purpose with or
+   without fee is hereby granted provided that the above copyright notice and
+   this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" WITHOUT ANY WARRANTY, AND ALL WARRANTIES,
+   WHETHER EXPRESSED OR IMPLIED, INCLUDING MERCHANTABILITY AND FITNESS FOR
+   PURPOSE, ARE DISCLAIMED.
+
+  ==============================================================================
+*/
+
+/*******************************************************************************
+ The block below describes the properties of this PIP. A PIP is a short snippet
+ of code that can be read by the Projucer and used to generate a JUCE project.
+
+ BEGIN_JUCE_PIP_METADATA
+
+ name:             SynthUsingMidiInputTutorial
+ version:          1.0.0
+ vendor:           JUCE
+ website:          http://juce.com
+ description:      Synthesiser with midi input.
+
+ dependencies:     juce_audio_basics, juce_audio_devices, juce_audio_formats,
+                   juce_audio_processors, juce_audio_utils, juce_core,
+                   juce_data_structures, juce_events, juce_graphics,
+                   juce_gui_basics, juce_gui_extra
+ exporters:        xcode_mac, vs2019, linux_make
+
+ type:             Component
+ mainClass:        MainContentComponent
+
+ useLocalCopy:     1
+
+ END_JUCE_PIP_METADATA
+
+*******************************************************************************/
+#include <string>
+
+#pragma once
+
+#include "Arpeggiator.h"
+#include "Wavetable.h"
+#include "WavetableManager.h"
+#include "PolyBlepOscillator.h"
+#include "FastSine.h"
+#include "SessionRecorder.h"
+#include "MemoryUsage.h"
+#include "ScratchArena.h"
+#include "MasterEffects.h"
+#include "AudioSampleFifo.h"
+#include "NoteRenderCache.h"
+#include "StartupProfile.h"
+//==============================================================================
+class WavetableOscillator
+{
+public:
+	WavetableOscillator() = default;
+	
+	WavetableOscillator (const juce::AudioSampleBuffer& wavetableToUse)
+	{
+		setWavetable (wavetableToUse);
+	}
+	
+	/** Switches table, keeping the phase and frequency. Used when a note moves
+	    to a different mipmap level or layer without restarting.
+	*/
+	void setWavetable (const juce::AudioSampleBuffer& wavetableToUse)
+	{
+		jassert (wavetableToUse.getNumChannels() == 1);
+		
+		auto newTableSize = wavetableToUse.getNumSamples() - 1;
+		
+		if (tableSize > 0 && newTableSize != tableSize)
+		{
+			auto scale = (float) newTableSize / (float) tableSize;
+			currentIndex *= scale;
+			tableDelta *= scale;
+			targetDelta *= scale;
+			segmentStartDelta *= scale;
+		}
+		
+		wavetable = &wavetableToUse;
+		tableSize = newTableSize;
+	}
+	
+	void resetPhase() noexcept
+	{
+		currentIndex = 0.0f;
+	}
+	
+	/** Scales the phase increment on top of any glide, e.g. for vibrato. */
+	void setPitchRatio (float newRatio) noexcept
+	{
+		pitchRatio = newRatio;
+	}
+	
+	void setFrequency (float frequency, float sampleRate)
+	{
+		auto tableSizeOverSampleRate = (float) tableSize / sampleRate;
+		tableDelta = frequency * tableSizeOverSampleRate;
+		targetDelta = tableDelta;
+		glideSamplesRemaining = 0;
+		glideRatio = 1.0f;
+	}
+	
+	/** Ramps the phase increment exponentially (i.e. linearly in pitch) from
+	    its current value to the given frequency over numSamples samples.
+	*/
+	void glideToFrequency (float frequency, float sampleRate, int numSamples)
+	{
+		targetDelta = frequency * (float) tableSize / sampleRate;
+		glideSamplesRemaining = juce::jmax (0, numSamples);
+		
+		if (glideSamplesRemaining == 0 || tableDelta <= 0.0f)
+			setFrequency (frequency, sampleRate);
+	}
+	
+	/** Returns how many of the next maxSamples can be rendered with a single
+	    per-sample ratio. The ratio is recomputed in closed form from the
+	    remaining distance, so rounding never accumulates across blocks.
+	*/
+	int beginSegment (int maxSamples) noexcept
+	{
+		if (glideSamplesRemaining <= 0)
+			return maxSamples;
+		
+		segmentLength = juce::jmin (maxSamples, glideSamplesRemaining);
+		segmentStartDelta = tableDelta;
+		glideRatio = (float) std::pow ((double) targetDelta / tableDelta, 1.0 / glideSamplesRemaining);
+		
+		return segmentLength;
+	}
+	
+	void endSegment() noexcept
+	{
+		if (glideSamplesRemaining <= 0)
+			return;
+		
+		glideSamplesRemaining -= segmentLength;
+		
+		if (glideSamplesRemaining > 0)
+		{
+			tableDelta = segmentStartDelta * (float) std::pow ((double) glideRatio, (double) segmentLength);
+		}
+		else
+		{
+			tableDelta = targetDelta;
+			glideRatio = 1.0f;
+		}
+	}
+	
+	forcedinline float getNextSample() noexcept
+	{
+		auto index0 = (unsigned int) currentIndex;
+		auto index1 = index0 + 1;
+		
+		auto frac = currentIndex - (float) index0;
+		
+		auto* table = wavetable->getReadPointer (0);
+		auto value0 = table[index0];
+		auto value1 = table[index1];
+		
+		auto currentSample = value0 + frac * (value1 - value0);
+		
+		// a big enough bend can step more than a whole cycle
+		currentIndex += tableDelta * pitchRatio;
+		
+		while (currentIndex >= (float) tableSize)
+			currentIndex -= (float) tableSize;
+		
+		tableDelta *= glideRatio;
+		
+		return currentSample;
+	}
+	
+private:
+	const juce::AudioSampleBuffer* wavetable = nullptr;
+	int tableSize = 0;
+	float currentIndex = 0.0f, tableDelta = 0.0f;
+	float targetDelta = 0.0f, glideRatio = 1.0f, segmentStartDelta = 0.0f;
+	float pitchRatio = 1.0f;
+	int glideSamplesRemaining = 0, segmentLength = 0;
+};
+
+//==============================================================================
+/** Velocity and key-range layers over mipmapped wavetables.
+
+    Which layers sound for a note and velocity, and how loud each is across a
+    crossfade, is worked out once here into a 128 x 128 lookup table, so a voice
+    only does two table reads at note-on. The same table carries the velocity
+    curve and each timbre's loudness normalisation.
+*/
+struct SineWaveSound   : public juce::SynthesiserSound
+{
+    struct Layer
+    {
+        int lowNote, highNote, lowVelocity, highVelocity;
+        int timbre;
+    };
+
+    /** Up to two layers for one note/velocity, with equal-power crossfade gains.
+        level is the velocity curve times the first layer's loudness correction;
+        secondGain is relative to it.
+    */
+    struct LayerSelection
+    {
+        juce::int8 first = -1, second = -1;
+        float firstGain = 0.0f, secondGain = 0.0f;
+        float level = 0.0f;
+    };
+
+    /** How MIDI velocity maps to level, before loudness normalisation. */
+    enum class VelocityCurve
+    {
+        linear = 1,
+        soft,
+        hard,
+        fixed
+    };
+
+    /** What voices play: the wavetable layers, or one table-free PolyBLEP
+        waveform, in the same order as PolyBlepOscillator::Waveform.
+    */
+    enum class Oscillator
+    {
+        wavetable = 1,
+        saw,
+        square,
+        triangle,
+        pulse
+    };
+
+    /** Level of one voice at full velocity, for a timbre as loud as a sine. */
+    static constexpr float maxVoiceLevel = 0.025f;
+
+    /** With a manager, the tables' levels can be evicted and rebuilt to stay
+        within its budget; without one they are all kept resident.
+    */
+    explicit SineWaveSound (WavetableManager* managerToUse = nullptr)
+        : manager (managerToUse)
+    {
+		createWavetables();
+		createLayerSelections();
+
+        if (manager != nullptr)
+            for (auto& timbre : timbres)
+                manager->addTable (*timbre);
+	}
+
+    ~SineWaveSound() override
+    {
+        if (manager != nullptr)
+            for (auto& timbre : timbres)
+                manager->removeTable (*timbre);
+    }
+
+    bool appliesToNote    (int) override        { return true; }
+    bool appliesToChannel (int) override        { return true; }
+
+    void prepareToPlay (double sampleRate)
+    {
+        for (auto& timbre : timbres)
+            timbre->prepare (sampleRate);
+    }
+
+    const LayerSelection& getLayerSelection (int midiNoteNumber, int velocity) const noexcept
+    {
+        return layerSelections[(size_t) (juce::jlimit (0, 127, midiNoteNumber) * 128 + juce::jlimit (0, 127, velocity))];
+    }
+
+    /** Rebuilds the layer table. Not real-time safe; SineWaveSynth calls this
+        under its lock.
+    */
+    void setVelocityCurve (VelocityCurve newCurve)
+    {
+        velocityCurve = newCurve;
+        createLayerSelections();
+    }
+
+    /** Not real-time safe; SineWaveSynth calls this under its lock. Notes
+        already sounding keep the oscillator they started with.
+    */
+    void setOscillator (Oscillator newOscillator)
+    {
+        oscillator = newOscillator;
+
+        if (oscillator != Oscillator::wavetable)
+            oscillatorLoudness = juce::MathConstants<float>::sqrt2 * 0.5f
+                                  / PolyBlepOscillator::getRms (getWaveform(), pulseWidth);
+    }
+
+    Oscillator getOscillator() const noexcept                       { return oscillator; }
+    PolyBlepOscillator::Waveform getWaveform() const noexcept       { return (PolyBlepOscillator::Waveform) ((int) oscillator - 1); }
+
+    static constexpr float pulseWidth = 0.25f;
+
+    /** Level for a PolyBLEP note, with the same velocity curve and loudness
+        matching as the wavetable layers.
+    */
+    float getOscillatorLevel (int velocity) const noexcept
+    {
+        return velocityLevels[(size_t) juce::jlimit (0, 127, velocity)] * oscillatorLoudness;
+    }
+
+    static float getVelocityCurveGain (VelocityCurve curve, int velocity) noexcept
+    {
+        auto proportion = juce::jlimit (0, 127, velocity) / 127.0f;
+
+        switch (curve)
+        {
+            case VelocityCurve::soft:   return std::sqrt (proportion);
+            case VelocityCurve::hard:   return proportion * proportion;
+            case VelocityCurve::fixed:  return velocity > 0 ? 1.0f : 0.0f;
+            case VelocityCurve::linear:
+            default:                    return proportion;
+        }
+    }
+
+    /** Audio thread: pins a resident mipmap level of timbre for the note and
+        returns it; see MipmappedWavetable::acquireLevelForNote(). Hand it back
+        with releaseWaveTable() when the note ends.
+    */
+    int acquireWaveTable (int timbre, int midiNoteNumber) noexcept
+    {
+        return timbres[(size_t) timbre]->acquireLevelForNote (midiNoteNumber);
+    }
+
+    /** Audio thread: the note's exact level if it has become resident, else -1. */
+    int tryAcquireExactWaveTable (int timbre, int midiNoteNumber) noexcept
+    {
+        return timbres[(size_t) timbre]->tryAcquireExactLevelForNote (midiNoteNumber);
+    }
+
+    void releaseWaveTable (int timbre, int level) noexcept
+    {
+        timbres[(size_t) timbre]->releaseLevel (level);
+    }
+
+    /** Only while the level is pinned. */
+    const juce::AudioSampleBuffer& getWaveTable (int timbre, int level) const noexcept
+    {
+        return timbres[(size_t) timbre]->getLevel (level);
+    }
+
+    /** The level acquireWaveTable() gives when nothing has been evicted. */
+    int getExactLevel (int timbre, int midiNoteNumber) const noexcept
+    {
+        return timbres[(size_t) timbre]->getLevelForNote (midiNoteNumber);
+    }
+
+    size_t getMemoryUsage() const noexcept
+    {
+        auto bytes = MemoryUsage::getAllocatedBytes (layerSelections);
+
+        for (auto& timbre : timbres)
+            bytes += timbre->getMemoryUsage();
+
+        return bytes;
+    }
+
+private:
+	void createWavetables()
+	{
+       #if SYNTH_EMBED_WAVETABLES
+		// both timbres are built at compile time; see EmbeddedWavetables.h
+		timbres.push_back (std::make_unique<MipmappedWavetable> (EmbeddedWavetables::soft));
+		timbres.push_back (std::make_unique<MipmappedWavetable> (EmbeddedWavetables::bright));
+       #else
+        // with a manager to build them, levels wait until a note needs them
+        auto build = manager != nullptr ? MipmappedWavetable::Build::onDemand : MipmappedWavetable::Build::upFront;
+
+        for (auto* recipe : { &EmbeddedWavetables::softRecipe, &EmbeddedWavetables::brightRecipe })
+            timbres.push_back (std::make_unique<MipmappedWavetable> (std::vector<float> (recipe->weights, recipe->weights + recipe->numHarmonics),
+                                                                     EmbeddedWavetables::tableSize, build));
+       #endif
+
+        // bring every timbre's full-bandwidth level to the RMS of a sine
+        for (auto& timbre : timbres)
+            loudnessGains.push_back (juce::MathConstants<float>::sqrt2 * 0.5f / timbre->getRms (0));
+	}
+
+    void createLayerSelections()
+    {
+        const Layer layers[] = { { 0, 127, 0,  80,  0 },
+                                 { 0, 108, 48, 127, 1 } };
+
+        layerSelections.resize (128 * 128);
+
+        for (auto velocity = 0; velocity < 128; ++velocity)
+            velocityLevels[(size_t) velocity] = maxVoiceLevel * getVelocityCurveGain (velocityCurve, velocity);
+
+        for (auto note = 0; note < 128; ++note)
+        {
+            for (auto velocity = 0; velocity < 128; ++velocity)
+            {
+                auto& selection = layerSelections[(size_t) (note * 128 + velocity)];
+                selection = {};
+
+                for (auto i = 0; i < juce::numElementsInArray (layers); ++i)
+                {
+                    const auto& layer = layers[i];
+
+                    if (note < layer.lowNote || note > layer.highNote
+                         || velocity < layer.lowVelocity || velocity > layer.highVelocity)
+                        continue;
+
+                    if (selection.first < 0)
+                        selection.first = (juce::int8) layer.timbre;
+                    else if (selection.second < 0)
+                        selection.second = (juce::int8) layer.timbre;
+                }
+
+                selection.firstGain = 1.0f;
+
+                if (selection.second >= 0)
+                {
+                    // the overlap runs from the second layer's bottom to the first layer's top
+                    auto overlapLow  = (float) layers[1].lowVelocity;
+                    auto overlapHigh = (float) layers[0].highVelocity;
+                    auto position = juce::jlimit (0.0f, 1.0f, ((float) velocity - overlapLow) / (overlapHigh - overlapLow));
+
+                    selection.firstGain  = std::cos (position * juce::MathConstants<float>::halfPi);
+                    selection.secondGain = std::sin (position * juce::MathConstants<float>::halfPi)
+                                            * loudnessGains[(size_t) selection.second] / loudnessGains[(size_t) selection.first];
+                }
+
+                if (selection.first >= 0)
+                    selection.level = velocityLevels[(size_t) velocity] * loudnessGains[(size_t) selection.first];
+            }
+        }
+    }
+
+    WavetableManager* manager;
+	std::vector<std::unique_ptr<MipmappedWavetable>> timbres;
+	std::vector<LayerSelection> layerSelections;
+    std::vector<float> loudnessGains;
+    VelocityCurve velocityCurve = VelocityCurve::linear;
+    std::array<float, 128> velocityLevels;
+    Oscillator oscillator = Oscillator::wavetable;
+    float oscillatorLoudness = 1.0f;
+};
+
+//==============================================================================
+/** How expression shapes a voice. Pressure is whichever is higher of the
+    note's polyphonic aftertouch, its channel's pressure and, for MPE notes,
+    the zone master channel's pressure.
+*/
+struct ExpressionRouting
+{
+    /** Gain at full pressure is 1 + levelDepth. */
+    float levelDepth = 1.0f;
+
+    /** How far below maxFilterHz a one-pole lowpass rests with no pressure and
+        with timbre (CC74) at zero. It opens fully at full pressure and full
+        timbre; when both depths come to nothing the filter is bypassed.
+    */
+    float filterOctaves = 0.0f, timbreOctaves = 4.0f;
+
+    /** Vibrato depth at full pressure. */
+    float vibratoCents = 30.0f, vibratoHz = 5.5f;
+
+    float smoothingSeconds = 0.01f;
+
+    static constexpr float maxFilterHz = 18000.0f;
+};
+
+/** The latest coalesced expression on one MIDI channel. */
+struct ChannelExpression
+{
+    float pressure = 0.0f;
+    float pitchBendSemitones = 0.0f;
+    float timbre = 1.0f;
+};
+
+//==============================================================================
+/** Everything a SineWaveVoice touches per sample. SineWaveSynth keeps these in
+    one contiguous array and renders them in a single pass, rather than making
+    a virtual renderNextBlock() call into each separately allocated voice.
+*/
+struct SineWaveVoiceState
+{
+    /** Samples per segment, which is also the control rate for glide and
+        expression, and the arena space one render pass needs.
+    */
+    static constexpr int scratchSize = 64;
+    static constexpr size_t scratchBytes = 2 * ScratchArena::getAlignedBytes (scratchSize);
+
+    /** Returns false once the release has died away and the note should be cleared. */
+    bool render (juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples,
+                 float* scratchA, float* scratchB)
+    {
+		while (notePlaying && numSamples > 0)
+		{
+			auto segment = juce::jmin (numSamples, scratchSize);
+
+			if (cacheEntry >= 0)
+				segment = juce::jmin (segment, renderCache->getEntrySamples() - cachePosition);
+
+			if (useAnalog)
+			{
+				segment = analog.beginSegment (segment);
+			}
+			else
+			{
+				segment = oscA.beginSegment (segment);
+
+				if (timbreB >= 0)
+					oscB.beginSegment (segment);
+			}
+
+			auto pressureGainAtStart = pressureGain;
+			updateExpression (segment);
+
+			renderSegment (outputBuffer, startSample, segment, scratchA, scratchB, pressureGainAtStart);
+
+			if (cacheEntry >= 0 && (! notePlaying || cachePosition >= renderCache->getEntrySamples()))
+				leaveCache (notePlaying);
+
+			if (notePlaying)
+			{
+				if (useAnalog)
+				{
+					analog.endSegment();
+				}
+				else
+				{
+					oscA.endSegment();
+
+					if (timbreB >= 0)
+						oscB.endSegment();
+				}
+			}
+
+			startSample += segment;
+			numSamples -= segment;
+		}
+
+        return notePlaying;
+    }
+
+    /** Clears the expression left over from the previous note. */
+    void resetExpression() noexcept
+    {
+        pressure = 0.0f;
+        pressureGain = 1.0f;
+        vibratoPhase = 0.0f;
+        filterState = 0.0f;
+        oscA.setPitchRatio (1.0f);
+        oscB.setPitchRatio (1.0f);
+        analog.setPitchRatio (1.0f);
+        pitchRatio = 1.0f;
+    }
+
+    /** Once per segment: smooths pressure, pitch bend and timbre towards the
+        latest coalesced values and derives this segment's level, pitch and
+        filter settings from them.
+    */
+    void updateExpression (int numSamples) noexcept
+    {
+        auto targetPressure = 0.0f, targetPitchBend = 0.0f, targetTimbre = 1.0f;
+
+        if (channel != nullptr)
+        {
+            targetPressure = juce::jmax (*notePressure, channel->pressure, master->pressure);
+            targetPitchBend = channel->pitchBendSemitones + master->pitchBendSemitones;
+            targetTimbre = channel->timbre;
+        }
+
+        if (pressure != targetPressure || pitchBend != targetPitchBend || timbre != targetTimbre)
+        {
+            auto coefficient = 1.0f - std::exp (-(float) numSamples / (routing->smoothingSeconds * sampleRate));
+
+            smoothTowards (pressure, targetPressure, coefficient);
+            smoothTowards (pitchBend, targetPitchBend, coefficient);
+            smoothTowards (timbre, targetTimbre, coefficient);
+        }
+
+        pressureGain = 1.0f + routing->levelDepth * pressure;
+
+        auto cents = 100.0f * pitchBend;
+
+        if (pressure > 0.0f)
+            cents += routing->vibratoCents * pressure * FastSine::sinTurns (vibratoPhase);
+
+        pitchRatio = cents != 0.0f ? std::exp2 (cents / 1200.0f) : 1.0f;
+        oscA.setPitchRatio (pitchRatio);
+        oscB.setPitchRatio (pitchRatio);
+        analog.setPitchRatio (pitchRatio);
+
+        vibratoPhase += routing->vibratoHz * (float) numSamples / sampleRate;
+
+        if (vibratoPhase >= 1.0f)
+            vibratoPhase -= 1.0f;
+
+        auto octavesClosed = routing->filterOctaves * (1.0f - pressure) + routing->timbreOctaves * (1.0f - timbre);
+        filterActive = octavesClosed > 0.0f;
+
+        if (filterActive)
+        {
+            auto cutoff = juce::jmin (ExpressionRouting::maxFilterHz * std::exp2 (-octavesClosed), 0.45f * sampleRate);
+            filterCoefficient = 1.0f - std::exp (-juce::MathConstants<float>::twoPi * cutoff / sampleRate);
+        }
+    }
+
+    static void smoothTowards (float& value, float target, float coefficient) noexcept
+    {
+        value += (target - value) * coefficient;
+
+        if (std::abs (target - value) < 1.0e-4f)
+            value = target;
+    }
+
+    /** Renders both layers into scratch and crossfades them with vector ops (or
+        renders the PolyBLEP oscillator in their place, or copies them from the
+        render cache), then hands the result to the kernel for the current
+        envelope stage and output channel count.
+    */
+    void renderSegment (juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples,
+                        float* scratchA, float* scratchB, float pressureGainAtStart)
+    {
+        jassert (numSamples <= scratchSize);
+
+        auto releasing = tailOff > 0.0;
+        auto finishing = false;
+
+        if (releasing)
+        {
+            auto remaining = getReleaseSamplesRemaining();
+
+            if (remaining <= numSamples)
+            {
+                numSamples = remaining;
+                finishing = true;
+            }
+        }
+
+        if (cacheEntry >= 0 && ! isRepeatable())
+            leaveCache();
+
+        if (cacheEntry >= 0 && ! fillingCache)
+            juce::FloatVectorOperations::copy (scratchA, renderCache->getSamples (cacheEntry) + cachePosition, numSamples);
+        else
+            renderOscillators (scratchA, scratchB, numSamples);
+
+        if (cacheEntry >= 0)
+        {
+            if (fillingCache)
+                juce::FloatVectorOperations::copy (renderCache->getSamples (cacheEntry) + cachePosition, scratchA, numSamples);
+
+            cachePosition += numSamples;
+        }
+
+        if (filterActive)
+        {
+            for (auto i = 0; i < numSamples; ++i)
+                scratchA[i] = (filterState += filterCoefficient * (scratchA[i] - filterState));
+        }
+        else
+        {
+            // so the filter picks up where the signal is if it comes back in
+            filterState = scratchA[numSamples - 1];
+        }
+
+        if (releasing && silentBlocksToRelease > 0 && isSilent (scratchA, numSamples, pressureGainAtStart))
+        {
+            releasedEarly = true;
+            finishing = true;
+        }
+
+        auto numChannels = outputBuffer.getNumChannels();
+        auto kernel = getKernel (releasing, numChannels);
+
+        (this->*kernel) (outputBuffer.getArrayOfWritePointers(), numChannels, startSample, numSamples,
+                         scratchA, pressureGainAtStart, pressureGain);
+
+        if (finishing)
+            notePlaying = false;
+    }
+
+    void renderOscillators (float* scratchA, float* scratchB, int numSamples) noexcept
+    {
+        if (useAnalog)
+        {
+            analog.renderBlock (scratchA, numSamples);
+        }
+        else
+        {
+            for (auto i = 0; i < numSamples; ++i)
+                scratchA[i] = oscA.getNextSample();
+        }
+
+        if (! useAnalog && timbreB >= 0)
+        {
+            for (auto i = 0; i < numSamples; ++i)
+                scratchB[i] = oscB.getNextSample();
+
+            juce::FloatVectorOperations::multiply (scratchA, gainA, numSamples);
+            juce::FloatVectorOperations::addWithMultiply (scratchA, scratchB, gainB, numSamples);
+        }
+    }
+
+    //==============================================================================
+    /** Oscillator state at the end of a cached note start. */
+    struct CacheHandOff
+    {
+        WavetableOscillator oscA, oscB;
+        PolyBlepOscillator analog;
+    };
+
+    using RenderCache = NoteRenderCache<CacheHandOff>;
+
+    /** At note-on, once the oscillators are set up and only if the note
+        doesn't glide: plays the note's start from the cache if it's there,
+        otherwise records it for the next time.
+    */
+    void enterCache (const RenderCache::Key& key) noexcept
+    {
+        leaveCache (false);
+
+        if (renderCache == nullptr || ! renderCache->isEnabled())
+            return;
+
+        cachePosition = 0;
+        cacheEntry = renderCache->acquire (key);
+        fillingCache = cacheEntry < 0;
+
+        if (fillingCache)
+            cacheEntry = renderCache->beginFill (key);
+    }
+
+    /** Hands over to live synthesis, leaving the oscillators exactly where
+        rendering the cached samples would have unless the note is being
+        restarted anyway. A recording that stops short of the end is thrown away.
+    */
+    void leaveCache (bool carryOn = true) noexcept
+    {
+        if (cacheEntry < 0)
+            return;
+
+        if (fillingCache)
+        {
+            if (cachePosition >= renderCache->getEntrySamples())
+                renderCache->finishFill (cacheEntry, { oscA, oscB, analog });
+            else
+                renderCache->abandonFill (cacheEntry);
+        }
+        else
+        {
+            if (carryOn && cachePosition >= renderCache->getEntrySamples())
+            {
+                const auto& handOff = renderCache->getHandOff (cacheEntry);
+                oscA = handOff.oscA;
+                oscB = handOff.oscB;
+                analog = handOff.analog;
+            }
+            else if (carryOn)
+            {
+                catchUp (cachePosition);
+            }
+
+            renderCache->release (cacheEntry);
+        }
+
+        cacheEntry = -1;
+    }
+
+    /** How many semitones above the note bend and vibrato can take the pitch
+        before the next block, rounded up; negative when bent down. Smoothing
+        only moves towards the targets, so it can't overshoot this.
+    */
+    int getPitchHeadroom() const noexcept
+    {
+        if (channel == nullptr)
+            return 0;
+
+        auto bend = juce::jmax (pitchBend, channel->pitchBendSemitones + master->pitchBendSemitones);
+        auto maxPressure = juce::jmax (pressure, *notePressure, channel->pressure, master->pressure);
+
+        return (int) std::ceil (bend + routing->vibratoCents * 0.01f * maxPressure);
+    }
+
+    /** Cached samples are only valid while nothing but the note itself shapes
+        the oscillator output: no bend, pressure or filter.
+    */
+    bool isRepeatable() const noexcept
+    {
+        return pitchBend == 0.0f && pressure == 0.0f && ! filterActive;
+    }
+
+    /** Runs the oscillators over samples that were played from the cache, at
+        the unmodulated pitch they were cached at. Only needed when a note
+        leaves the cache part way through.
+    */
+    void catchUp (int numSamples) noexcept
+    {
+        float discardA[scratchSize], discardB[scratchSize];
+
+        oscA.setPitchRatio (1.0f);
+        oscB.setPitchRatio (1.0f);
+        analog.setPitchRatio (1.0f);
+
+        for (auto done = 0; done < numSamples; done += scratchSize)
+            renderOscillators (discardA, discardB, juce::jmin (scratchSize, numSamples - done));
+
+        oscA.setPitchRatio (pitchRatio);
+        oscB.setPitchRatio (pitchRatio);
+        analog.setPitchRatio (pitchRatio);
+    }
+
+    //==============================================================================
+    /** Tracks the peak this segment will add to the output. Returns true once
+        silentBlocksToRelease segments in a row have stayed under silenceFloor,
+        which can be well before the envelope reaches releaseFloor.
+    */
+    bool isSilent (const float* source, int numSamples, float pressureGainAtStart) noexcept
+    {
+        auto range = juce::FloatVectorOperations::findMinAndMax (source, numSamples);
+        auto peak = juce::jmax (-range.getStart(), range.getEnd())
+                      * (float) (level * tailOff) * juce::jmax (pressureGainAtStart, pressureGain);
+
+        silentBlocks = peak < silenceFloor ? silentBlocks + 1 : 0;
+        return silentBlocks >= silentBlocksToRelease;
+    }
+
+    /** Samples until the release first reaches releaseFloor, at least one. */
+    int getReleaseSamplesRemaining() const noexcept
+    {
+        return juce::jmax (1, (int) std::ceil (std::log (releaseFloor / tailOff) / std::log (releaseCoefficient)));
+    }
+
+    //==============================================================================
+    using Kernel = void (SineWaveVoiceState::*) (float* const*, int, int, int, const float*, float, float);
+
+    /** Picked once per segment, so the per-sample loops have no stage or channel
+        branches. Mono and stereo get their own unrolled kernels; numChannels == 0
+        handles any other count.
+    */
+    static Kernel getKernel (bool releasing, int numChannels) noexcept
+    {
+        static constexpr Kernel kernels[2][3] =
+        {
+            { &SineWaveVoiceState::renderKernel<false, 0>, &SineWaveVoiceState::renderKernel<false, 1>, &SineWaveVoiceState::renderKernel<false, 2> },
+            { &SineWaveVoiceState::renderKernel<true, 0>,  &SineWaveVoiceState::renderKernel<true, 1>,  &SineWaveVoiceState::renderKernel<true, 2> }
+        };
+
+        return kernels[releasing ? 1 : 0][numChannels == 1 || numChannels == 2 ? numChannels : 0];
+    }
+
+    template <bool releasing, int numChannels>
+    void renderKernel (float* const* channels, int channelCount, int startSample, int numSamples, const float* source,
+                       float pressureGainAtStart, float pressureGainAtEnd) noexcept
+    {
+        auto n = numChannels > 0 ? numChannels : channelCount;
+        auto gain = level * pressureGainAtStart;
+        auto gainStep = level * (pressureGainAtEnd - pressureGainAtStart) / numSamples;
+
+        for (auto i = startSample; i < startSample + numSamples; ++i)
+        {
+            auto currentSample = (float) (*source++ * (releasing ? gain * tailOff : gain));
+
+            for (auto channel = 0; channel < n; ++channel)
+                channels[channel][i] += currentSample;
+
+            gain += gainStep;
+
+            if (releasing)
+                tailOff *= releaseCoefficient;
+        }
+    }
+
+    static constexpr double releaseCoefficient = 0.99, releaseFloor = 0.005;
+
+    WavetableOscillator oscA, oscB;
+    PolyBlepOscillator analog;
+    bool useAnalog = false;
+    double level = 0.0, tailOff = 0.0;
+    float gainA = 1.0f, gainB = 0.0f;
+    int timbreB = -1;
+	bool notePlaying = false;
+
+    // early release: set by SineWaveSynth::setSilenceRelease()
+    float silenceFloor = 0.0f;
+    int silentBlocksToRelease = 0, silentBlocks = 0;
+    bool releasedEarly = false;
+
+    // set by SineWaveSynth: the routing, and where the coalesced expression for
+    // this voice's note, channel and MPE zone master channel is kept
+    const ExpressionRouting* routing = nullptr;
+    const float* notePressure = nullptr;
+    const ChannelExpression* channel = nullptr;
+    const ChannelExpression* master = nullptr;
+    float sampleRate = 44100.0f;
+
+    float pressure = 0.0f, pressureGain = 1.0f, pitchBend = 0.0f, timbre = 1.0f, pitchRatio = 1.0f;
+    float vibratoPhase = 0.0f; // in turns
+    float filterState = 0.0f, filterCoefficient = 1.0f;
+    bool filterActive = false;
+
+    // set by SineWaveSynth::setRenderCache(); see enterCache()
+    RenderCache* renderCache = nullptr;
+    int cacheEntry = -1, cachePosition = 0;
+    bool fillingCache = false;
+};
+
+//==============================================================================
+/** Note bookkeeping for JUCE's voice allocation. The per-sample state lives in
+    a SineWaveVoiceState owned by SineWaveSynth.
+*/
+struct SineWaveVoice   : public juce::SynthesiserVoice
+{
+    SineWaveVoice (SineWaveVoiceState& stateToUse, ScratchArena& arenaToUse)
+        : state (stateToUse), arena (arenaToUse) {}
+
+    bool canPlaySound (juce::SynthesiserSound* sound) override
+    {
+        return dynamic_cast<SineWaveSound*> (sound) != nullptr;
+    }
+
+    void startNote (int midiNoteNumber, float velocity,
+                    juce::SynthesiserSound* sound, int /*currentPitchWheelPosition*/) override
+    {
+        auto cyclesPerSecond = juce::MidiMessage::getMidiNoteInHertz (midiNoteNumber);
+        auto glideFrom = lastCyclesPerSecond;
+        auto isLegato = legatoTransition && state.notePlaying;
+
+        legatoTransition = false;
+        lastCyclesPerSecond = cyclesPerSecond;
+
+        auto* sineWaveSound = dynamic_cast<SineWaveSound*> (sound);
+        jassert (sineWaveSound != nullptr);
+
+        if (isLegato)
+        {
+            state.leaveCache();
+            state.tailOff = 0.0;
+
+            if (state.useAnalog)
+            {
+                state.analog.glideToFrequency ((float) cyclesPerSecond, (float) getSampleRate(), getGlideSamples());
+                return;
+            }
+
+            // keep the layers, but move to the mipmap level for the new pitch
+            holdTables (*sineWaveSound, midiNoteNumber);
+            state.oscA.glideToFrequency ((float) cyclesPerSecond, (float) getSampleRate(), getGlideSamples());
+
+            if (state.timbreB >= 0)
+                state.oscB.glideToFrequency ((float) cyclesPerSecond, (float) getSampleRate(), getGlideSamples());
+
+            return;
+        }
+
+        auto midiVelocity = juce::roundToInt (velocity * 127.0f);
+        auto glides = glideEnabled && glideFrom > 0.0;
+        const SineWaveVoiceState::RenderCache::Key cacheKey { sineWaveSound, (int) sineWaveSound->getOscillator(),
+                                                               midiNoteNumber, midiVelocity };
+
+        state.leaveCache (false);
+        state.tailOff = 0.0;
+        state.resetExpression();
+        state.useAnalog = sineWaveSound->getOscillator() != SineWaveSound::Oscillator::wavetable;
+
+        if (state.useAnalog)
+        {
+            releaseTables();
+            state.level = sineWaveSound->getOscillatorLevel (midiVelocity);
+            state.timbreB = -1;
+            state.analog.setWaveform (sineWaveSound->getWaveform());
+            state.analog.setPulseWidth (SineWaveSound::pulseWidth);
+            startOscillator (state.analog, glideFrom, cyclesPerSecond);
+            state.notePlaying = true;
+
+            if (! glides)
+                state.enterCache (cacheKey);
+
+            return;
+        }
+
+        const auto& layers = sineWaveSound->getLayerSelection (midiNoteNumber, midiVelocity);
+        state.level = layers.level;
+        timbreA = layers.first;
+        state.timbreB = layers.second;
+        state.gainA = layers.firstGain;
+        state.gainB = layers.secondGain;
+
+        auto exactTables = holdTables (*sineWaveSound, midiNoteNumber);
+        startOscillator (state.oscA, glideFrom, cyclesPerSecond);
+
+        if (state.timbreB >= 0)
+            startOscillator (state.oscB, glideFrom, cyclesPerSecond);
+
+		state.notePlaying = true;
+
+        // a note on a stand-in level mustn't be cached as the real thing
+        if (! glides && exactTables)
+            state.enterCache (cacheKey);
+    }
+
+    void stopNote (float /*velocity*/, bool allowTailOff) override
+    {
+        // the synth is handing this voice straight on to the next legato note
+        if (legatoTransition && state.notePlaying)
+            return;
+
+        if (allowTailOff)
+        {
+            if (state.tailOff == 0.0)
+            {
+                state.tailOff = 1.0;
+                state.silentBlocks = 0;
+                state.releasedEarly = false;
+            }
+        }
+        else
+        {
+            releaseTables();
+            clearCurrentNote();
+			state.notePlaying = false;
+            state.leaveCache (false);
+        }
+    }
+
+    void pitchWheelMoved (int) override      {}
+    void controllerMoved (int, int) override {}
+
+    /** Mono and legato modes glide from the previous note's pitch. */
+    void setGlide (bool shouldGlide, double seconds) noexcept
+    {
+        glideEnabled = shouldGlide;
+        glideSeconds = juce::jmax (0.0, seconds);
+    }
+
+    /** Marks the next stopNote()/startNote() pair as a legato note change, so the
+        voice keeps its phase and level and only glides to the new pitch.
+    */
+    void setLegatoTransition (bool isLegato) noexcept    { legatoTransition = isLegato; }
+
+    /** Called by SineWaveSynth before each block. Bend and vibrato move the
+        note to the mipmap level for the highest pitch they can reach, so its
+        harmonics stay below Nyquist. A note started on a stand-in level moves
+        to its own once the manager has built it. The phase carries on either
+        way, so only the brightness changes.
+    */
+    void updateTables() noexcept
+    {
+        if (heldSound == nullptr)
+            return;
+
+        if (getTableNote (heldNote) != tableNote)
+        {
+            holdTables (*heldSound, heldNote);
+            return;
+        }
+
+        if (! onStandIn)
+            return;
+
+        auto exactA = upgradeTable (heldA, state.oscA);
+        auto exactB = upgradeTable (heldB, state.oscB);
+        onStandIn = ! (exactA && exactB);
+    }
+
+    /** Called by SineWaveSynth when a batched render finishes this voice's release. */
+    void noteFinished()
+    {
+        releaseTables();
+        clearCurrentNote();
+    }
+
+    /** SineWaveSynth renders all its voices in one batch; this is only for
+        callers driving a single voice directly.
+    */
+    void renderNextBlock (juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples) override
+    {
+        if (! state.notePlaying)
+            return;
+
+        updateTables();
+
+        const ScratchArena::ScopedRewind rewind (arena);
+        auto* scratchA = arena.allocate (SineWaveVoiceState::scratchSize);
+        auto* scratchB = arena.allocate (SineWaveVoiceState::scratchSize);
+
+        if (scratchA != nullptr && scratchB != nullptr
+             && ! state.render (outputBuffer, startSample, numSamples, scratchA, scratchB))
+            clearCurrentNote();
+    }
+
+private:
+    struct HeldTable
+    {
+        int timbre = -1, level = -1;
+    };
+
+    /** The note whose mipmap level is safe for midiNoteNumber as currently bent. */
+    int getTableNote (int midiNoteNumber) const noexcept
+    {
+        return juce::jlimit (0, 127, midiNoteNumber + state.getPitchHeadroom());
+    }
+
+    /** Pins the mipmap levels for a note's layers at its bent pitch and points
+        the oscillators at them, then lets go of the ones held before. Returns
+        true if both are the exact levels for the unbent note, rather than
+        stand-ins for evicted ones or levels for a bend.
+    */
+    bool holdTables (SineWaveSound& sound, int midiNoteNumber) noexcept
+    {
+        auto note = getTableNote (midiNoteNumber);
+        HeldTable newA { timbreA, sound.acquireWaveTable (timbreA, note) }, newB;
+
+        if (state.timbreB >= 0)
+            newB = { state.timbreB, sound.acquireWaveTable (state.timbreB, note) };
+
+        releaseTables();
+        heldSound = &sound;
+        heldNote = midiNoteNumber;
+        tableNote = note;
+        heldA = newA;
+        heldB = newB;
+
+        state.oscA.setWavetable (sound.getWaveTable (heldA.timbre, heldA.level));
+
+        if (heldB.timbre >= 0)
+            state.oscB.setWavetable (sound.getWaveTable (heldB.timbre, heldB.level));
+
+        onStandIn = heldA.level != sound.getExactLevel (heldA.timbre, note)
+                     || (heldB.timbre >= 0 && heldB.level != sound.getExactLevel (heldB.timbre, note));
+
+        return ! onStandIn && note == midiNoteNumber;
+    }
+
+    /** Returns true once held is on its exact level, or isn't in use. */
+    bool upgradeTable (HeldTable& held, WavetableOscillator& osc) noexcept
+    {
+        if (held.timbre < 0 || held.level == heldSound->getExactLevel (held.timbre, tableNote))
+            return true;
+
+        auto level = heldSound->tryAcquireExactWaveTable (held.timbre, tableNote);
+
+        if (level < 0)
+            return false;
+
+        heldSound->releaseWaveTable (held.timbre, held.level);
+        held.level = level;
+        osc.setWavetable (heldSound->getWaveTable (held.timbre, level));
+        return true;
+    }
+
+    /** Before the voice lets go of its sound, which keeps the tables alive. */
+    void releaseTables() noexcept
+    {
+        if (heldSound == nullptr)
+            return;
+
+        heldSound->releaseWaveTable (heldA.timbre, heldA.level);
+
+        if (heldB.timbre >= 0)
+            heldSound->releaseWaveTable (heldB.timbre, heldB.level);
+
+        heldSound = nullptr;
+        heldA = {};
+        heldB = {};
+        onStandIn = false;
+    }
+
+    int getGlideSamples() const noexcept
+    {
+        return glideEnabled ? juce::roundToInt (glideSeconds * getSampleRate()) : 0;
+    }
+
+    /** Works for either oscillator type; a WavetableOscillator must already have its table. */
+    template <typename OscillatorType>
+    void startOscillator (OscillatorType& osc, double glideFrom, double cyclesPerSecond)
+    {
+        osc.resetPhase();
+
+        if (glideEnabled && glideFrom > 0.0)
+        {
+            osc.setFrequency ((float) glideFrom, (float) getSampleRate());
+            osc.glideToFrequency ((float) cyclesPerSecond, (float) getSampleRate(), getGlideSamples());
+        }
+        else
+        {
+            osc.setFrequency ((float) cyclesPerSecond, (float) getSampleRate());
+        }
+    }
+
+    SineWaveVoiceState& state;
+    ScratchArena& arena;
+
+    double glideSeconds = 0.0, lastCyclesPerSecond = 0.0;
+    bool glideEnabled = false, legatoTransition = false;
+    int timbreA = 0;
+
+    SineWaveSound* heldSound = nullptr;
+    HeldTable heldA, heldB;
+    int heldNote = 0, tableNote = 0;
+    bool onStandIn = false;
+};
+
+//==============================================================================
+/** Adds mono and legato voice modes on top of juce::Synthesiser.
+
+    In both modes only the first voice is used and the most recently held key
+    sounds. Mono retriggers the voice on every note; legato hands overlapping
+    notes to the already-sounding voice, which glides to the new pitch instead
+    of starting again.
+
+    Voices keep their per-sample state in one contiguous array here, which is
+    rendered in a single batch per sub-block.
+
+    With MPE zones set, each member channel's pitch bend, pressure and timbre
+    apply to the note on that channel, and the zone master channel's apply to
+    every note in the zone. Without zones, every channel behaves like a member
+    channel with a two-semitone bend range.
+*/
+class SineWaveSynth   : public juce::Synthesiser
+{
+public:
+    enum class VoiceMode
+    {
+        poly = 1,
+        mono,
+        legato
+    };
+
+    /** The voices' render state is allocated here in one block and never resized. */
+    SineWaveSynth (int numVoices, ScratchArena& arenaToUse)
+        : arena (arenaToUse),
+          voiceStates ((size_t) numVoices)
+    {
+        for (auto& state : voiceStates)
+        {
+            state.routing = &expressionRouting;
+            state.renderCache = &renderCache;
+            sineVoices.push_back (static_cast<SineWaveVoice*> (addVoice (new SineWaveVoice (state, arena))));
+        }
+
+        updateChannelRoles();
+        resetExpression();
+        setSilenceRelease (defaultSilenceFloorDb, defaultSilentBlocks);
+    }
+
+    /** Not real-time safe; call from prepareToPlay. */
+    void prepare (double sampleRate, size_t midiBufferBytes)
+    {
+        const juce::ScopedLock sl (lock);
+
+        setCurrentPlaybackSampleRate (sampleRate);
+        renderMidi.ensureSize (midiBufferBytes);
+        resetExpression();
+
+        for (auto& state : voiceStates)
+            state.sampleRate = (float) sampleRate;
+
+        prepareRenderCache();
+    }
+
+    //==============================================================================
+    /** Takes pressure, pitch bend and timbre (CC74) out of the MIDI before
+        juce::Synthesiser sees it, so a controller streaming expression doesn't
+        split the block into tiny sub-blocks. The latest value per note and per
+        channel is kept, and voices smooth towards it once per control block.
+    */
+    void renderNextBlock (juce::AudioBuffer<float>& outputAudio, const juce::MidiBuffer& inputMidi,
+                          int startSample, int numSamples)
+    {
+        // the zones and expression tables are shared with setMpeZones(); the base
+        // class takes this same lock again to render, which a CriticalSection allows
+        const juce::ScopedLock sl (lock);
+
+        if (extractExpression (inputMidi))
+            juce::Synthesiser::renderNextBlock (outputAudio, renderMidi, startSample, numSamples);
+        else
+            juce::Synthesiser::renderNextBlock (outputAudio, inputMidi, startSample, numSamples);
+
+        if (pressureSetThisBlock)
+        {
+            for (auto& channel : notePressureFromBlock)
+                channel.fill (false);
+
+            pressureSetThisBlock = false;
+        }
+    }
+
+    void setExpressionRouting (const ExpressionRouting& newRouting)
+    {
+        const juce::ScopedLock sl (lock);
+        expressionRouting = newRouting;
+    }
+
+    const ExpressionRouting& getExpressionRouting() const noexcept    { return expressionRouting; }
+
+    /** Sets up MPE lower and upper zones with this many member channels each;
+        0 removes a zone. MPE Configuration Messages arriving as MIDI change
+        the zones as well.
+    */
+    void setMpeZones (int lowerMemberChannels, int upperMemberChannels)
+    {
+        const juce::ScopedLock sl (lock);
+
+        zoneLayout.clearAllZones();
+
+        if (lowerMemberChannels > 0)
+            zoneLayout.setLowerZone (lowerMemberChannels);
+
+        if (upperMemberChannels > 0)
+            zoneLayout.setUpperZone (upperMemberChannels);
+
+        updateChannelRoles();
+    }
+
+    int getNumMpeMemberChannels (bool lowerZone) const noexcept
+    {
+        return zonesInUse[lowerZone ? 0 : 3];
+    }
+
+    void setVoiceMode (VoiceMode newMode)
+    {
+        const juce::ScopedLock sl (lock);
+
+        if (newMode == voiceMode)
+            return;
+
+        allNotesOff (0, false);
+        numHeld = 0;
+        voiceMode = newMode;
+        updateVoiceGlide();
+    }
+
+    VoiceMode getVoiceMode() const noexcept       { return voiceMode; }
+    double getGlideTime() const noexcept          { return glideSeconds; }
+
+    /** Frees a releasing voice once its output has stayed below floorDb (dBFS)
+        for numBlocks control blocks in a row, rather than waiting for the
+        envelope to die away. numBlocks of 0 leaves it to the envelope alone.
+    */
+    void setSilenceRelease (float floorDb, int numBlocks)
+    {
+        const juce::ScopedLock sl (lock);
+
+        silenceFloorDb = floorDb;
+        silentBlocksToRelease = juce::jmax (0, numBlocks);
+
+        for (auto& state : voiceStates)
+        {
+            state.silenceFloor = juce::Decibels::decibelsToGain (silenceFloorDb, -200.0f);
+            state.silentBlocksToRelease = silentBlocksToRelease;
+        }
+    }
+
+    float getSilenceFloorDb() const noexcept            { return silenceFloorDb; }
+    int getSilentBlocksToRelease() const noexcept       { return silentBlocksToRelease; }
+
+    /** Number of voices freed by setSilenceRelease() before their envelope ended. */
+    juce::int64 getNumEarlyReleases() const noexcept    { return numEarlyReleases; }
+
+    /** Keeps the first milliseconds of up to numEntries distinct notes (sound,
+        oscillator, pitch and velocity), so retriggering one copies its start
+        instead of rendering it. Only notes with no glide, bend, pressure or
+        filter use it, and they carry on live afterwards exactly as if they had
+        rendered the cached part. Either argument of 0 turns it off, which is
+        the default. Not real-time safe; it allocates the whole pool up front.
+    */
+    void setRenderCache (double milliseconds, int numEntries)
+    {
+        const juce::ScopedLock sl (lock);
+
+        renderCacheMilliseconds = juce::jmax (0.0, milliseconds);
+        renderCacheEntries = juce::jmax (0, numEntries);
+        prepareRenderCache();
+    }
+
+    double getRenderCacheMilliseconds() const noexcept    { return renderCacheMilliseconds; }
+    int getRenderCacheEntries() const noexcept            { return renderCacheEntries; }
+
+    /** Notes that started from the render cache. */
+    juce::int64 getNumRenderCacheHits() const noexcept    { return renderCache.getNumHits(); }
+
+    /** True if any voice is still sounding, including in its release. */
+    bool isAnyVoiceActive() const noexcept
+    {
+        for (auto& state : voiceStates)
+            if (state.notePlaying)
+                return true;
+
+        return false;
+    }
+
+    /** Number of notes that had to take over a voice that was still sounding. */
+    juce::int64 getNumVoiceSteals() const noexcept    { return numVoiceSteals; }
+
+    /** The voices owned now, the vectors behind them as allocated, and the render cache. */
+    size_t getVoiceMemoryUsage() const noexcept
+    {
+        return (size_t) getNumVoices() * sizeof (SineWaveVoice)
+                + MemoryUsage::getAllocatedBytes (voiceStates) + MemoryUsage::getAllocatedBytes (sineVoices)
+                + renderCache.getMemoryUsage();
+    }
+
+    /** What the buffer expression is stripped into has allocated. */
+    size_t getMidiMemoryUsage() const noexcept    { return MemoryUsage::getAllocatedBytes (renderMidi); }
+
+    void setGlideTime (double seconds)
+    {
+        const juce::ScopedLock sl (lock);
+        glideSeconds = seconds;
+        updateVoiceGlide();
+    }
+
+    /** Rebuilds every sound's level tables, so call it when loading a patch rather than per note. */
+    void setVelocityCurve (SineWaveSound::VelocityCurve newCurve)
+    {
+        const juce::ScopedLock sl (lock);
+        velocityCurve = newCurve;
+
+        for (auto* sound : sounds)
+            if (auto* sineSound = dynamic_cast<SineWaveSound*> (sound))
+                sineSound->setVelocityCurve (velocityCurve);
+    }
+
+    SineWaveSound::VelocityCurve getVelocityCurve() const noexcept    { return velocityCurve; }
+
+    /** Switches one sound between its wavetable layers and a PolyBLEP
+        waveform. Each sound keeps its own, so every patch can play a
+        different one.
+    */
+    void setOscillator (SineWaveSound& sound, SineWaveSound::Oscillator newOscillator)
+    {
+        const juce::ScopedLock sl (lock);
+        sound.setOscillator (newOscillator);
+    }
+
+    //==============================================================================
+    void noteOn (int midiChannel, int midiNoteNumber, float velocity) override
+    {
+        if (voiceMode == VoiceMode::poly)
+        {
+            const juce::ScopedLock sl (lock);
+
+            resetNotePressure (midiChannel, midiNoteNumber);
+            juce::Synthesiser::noteOn (midiChannel, midiNoteNumber, velocity);
+
+            // the voice that just started is the only one with this note whose key is down
+            for (size_t i = 0; i < sineVoices.size(); ++i)
+            {
+                auto* voice = sineVoices[i];
+
+                if (voice->getCurrentlyPlayingNote() == midiNoteNumber && voice->isPlayingChannel (midiChannel)
+                     && voice->isKeyDown())
+                    attachExpression (i, midiChannel, midiNoteNumber, true);
+            }
+
+            return;
+        }
+
+        const juce::ScopedLock sl (lock);
+
+        removeHeldNote (midiNoteNumber);
+
+        if (numHeld < (int) heldNotes.size())
+            heldNotes[(size_t) numHeld++] = midiNoteNumber;
+
+        lastVelocity = velocity;
+        playMonoNote (midiChannel, midiNoteNumber, velocity);
+    }
+
+    void noteOff (int midiChannel, int midiNoteNumber, float velocity, bool allowTailOff) override
+    {
+        if (voiceMode == VoiceMode::poly)
+        {
+            const juce::ScopedLock sl (lock);
+
+            if (auto* voice = findVoiceWithKeyDown (midiChannel, midiNoteNumber))
+            {
+                voice->setKeyDown (false);
+
+                if (! (voice->isSustainPedalDown() || voice->isSostenutoPedalDown()))
+                    stopVoice (voice, velocity, allowTailOff);
+            }
+
+            return;
+        }
+
+        const juce::ScopedLock sl (lock);
+
+        removeHeldNote (midiNoteNumber);
+
+        auto* voice = getMonoVoice();
+
+        if (voice == nullptr || voice->getCurrentlyPlayingNote() != midiNoteNumber)
+            return;
+
+        if (numHeld > 0)
+        {
+            playMonoNote (midiChannel, heldNotes[(size_t) numHeld - 1], lastVelocity);
+            return;
+        }
+
+        voice->setKeyDown (false);
+
+        if (! (voice->isSustainPedalDown() || voice->isSostenutoPedalDown()))
+            stopVoice (voice, velocity, allowTailOff);
+    }
+
+protected:
+    using juce::Synthesiser::renderVoices;
+
+    /** Renders every voice in one pass over the contiguous state array, sharing
+        one set of scratch buffers. Only SineWaveVoices are ever added, so the
+        base class's virtual call per voice isn't needed.
+    */
+    void renderVoices (juce::AudioBuffer<float>& outputAudio, int startSample, int numSamples) override
+    {
+        const ScratchArena::ScopedRewind rewind (arena);
+        auto* scratchA = arena.allocate (SineWaveVoiceState::scratchSize);
+        auto* scratchB = arena.allocate (SineWaveVoiceState::scratchSize);
+
+        if (scratchA == nullptr || scratchB == nullptr)
+            return;
+
+        for (size_t i = 0; i < voiceStates.size(); ++i)
+        {
+            auto& state = voiceStates[i];
+
+            if (! state.notePlaying)
+                continue;
+
+            sineVoices[i]->updateTables();
+
+            if (! state.render (outputAudio, startSample, numSamples, scratchA, scratchB))
+            {
+                if (state.releasedEarly)
+                    ++numEarlyReleases;
+
+                sineVoices[i]->noteFinished();
+            }
+        }
+    }
+
+    juce::SynthesiserVoice* findFreeVoice (juce::SynthesiserSound* soundToPlay, int midiChannel,
+                                           int midiNoteNumber, bool stealIfNoneAvailable) const override
+    {
+        auto* voice = juce::Synthesiser::findFreeVoice (soundToPlay, midiChannel, midiNoteNumber, stealIfNoneAvailable);
+
+        if (voice != nullptr && voice->isVoiceActive())
+            ++numVoiceSteals;
+
+        return voice;
+    }
+
+private:
+    SineWaveVoice* getMonoVoice() const
+    {
+        return sineVoices.empty() ? nullptr : sineVoices.front();
+    }
+
+    void playMonoNote (int midiChannel, int midiNoteNumber, float velocity)
+    {
+        auto* voice = getMonoVoice();
+
+        if (voice == nullptr)
+            return;
+
+        for (auto* sound : sounds)
+        {
+            if (sound->appliesToNote (midiNoteNumber) && sound->appliesToChannel (midiChannel)
+                 && voice->canPlaySound (sound))
+            {
+                auto isLegato = voiceMode == VoiceMode::legato && voice->isVoiceActive() && voice->isKeyDown();
+
+                resetNotePressure (midiChannel, midiNoteNumber);
+                voice->setLegatoTransition (isLegato);
+                startVoice (voice, sound, midiChannel, midiNoteNumber, velocity);
+                voice->setLegatoTransition (false);
+                attachExpression (0, midiChannel, midiNoteNumber, ! isLegato);
+                return;
+            }
+        }
+    }
+
+    float& getNotePressure (int midiChannel, int midiNoteNumber) noexcept
+    {
+        return notePressure[(size_t) juce::jlimit (0, 15, midiChannel - 1)][(size_t) juce::jlimit (0, 127, midiNoteNumber)];
+    }
+
+    /** A new note starts without the last one's pressure, unless this block's
+        MIDI already set it: extractExpression() has applied the note-on and any
+        poly aftertouch after it in order, before the voices render.
+    */
+    void resetNotePressure (int midiChannel, int midiNoteNumber) noexcept
+    {
+        if (! notePressureFromBlock[(size_t) juce::jlimit (0, 15, midiChannel - 1)][(size_t) juce::jlimit (0, 127, midiNoteNumber)])
+            getNotePressure (midiChannel, midiNoteNumber) = 0.0f;
+    }
+
+    void setNotePressureFromBlock (int midiChannel, int midiNoteNumber, float pressure) noexcept
+    {
+        getNotePressure (midiChannel, midiNoteNumber) = pressure;
+        notePressureFromBlock[(size_t) juce::jlimit (0, 15, midiChannel - 1)][(size_t) juce::jlimit (0, 127, midiNoteNumber)] = true;
+        pressureSetThisBlock = true;
+    }
+
+    /** Points a voice's state at the expression for its note and channel, and
+        records it in the channel + note -> voice lookup. A fresh note starts
+        at the current bend and timbre rather than gliding from the last one.
+    */
+    void attachExpression (size_t voiceIndex, int midiChannel, int midiNoteNumber, bool isFreshNote) noexcept
+    {
+        auto channelIndex = (size_t) juce::jlimit (0, 15, midiChannel - 1);
+        auto masterChannel = zoneMasterForChannel[channelIndex];
+        auto& state = voiceStates[voiceIndex];
+
+        state.notePressure = &getNotePressure (midiChannel, midiNoteNumber);
+        state.channel = &channelExpression[channelIndex];
+        state.master = &channelExpression[masterChannel > 0 ? (size_t) masterChannel - 1 : noMasterChannel];
+
+        if (isFreshNote)
+        {
+            state.pitchBend = state.channel->pitchBendSemitones + state.master->pitchBendSemitones;
+            state.timbre = state.channel->timbre;
+        }
+
+        voiceForNote[channelIndex][(size_t) juce::jlimit (0, 127, midiNoteNumber)] = (juce::int8) voiceIndex;
+    }
+
+    /** O(1): the lookup is only a hint, so a stale entry from a finished or
+        stolen voice is caught by checking what the voice is playing now.
+    */
+    SineWaveVoice* findVoiceWithKeyDown (int midiChannel, int midiNoteNumber) const noexcept
+    {
+        auto index = voiceForNote[(size_t) juce::jlimit (0, 15, midiChannel - 1)][(size_t) juce::jlimit (0, 127, midiNoteNumber)];
+
+        if (index < 0)
+            return nullptr;
+
+        auto* voice = sineVoices[(size_t) index];
+
+        return voice->getCurrentlyPlayingNote() == midiNoteNumber && voice->isPlayingChannel (midiChannel)
+                && voice->isKeyDown() ? voice : nullptr;
+    }
+
+    void resetExpression() noexcept
+    {
+        for (auto& channel : notePressure)
+            channel.fill (0.0f);
+
+        channelExpression.fill ({});
+
+        for (auto& channel : voiceForNote)
+            channel.fill (-1);
+    }
+
+    /** Works out each channel's MPE master and pitch bend range from the zones. */
+    void updateChannelRoles() noexcept
+    {
+        zonesInUse = summariseZones();
+
+        for (auto channel = 1; channel <= 16; ++channel)
+        {
+            auto index = (size_t) channel - 1;
+            zoneMasterForChannel[index] = 0;
+            pitchBendRange[index] = 2.0f;
+
+            for (const auto& zone : { zoneLayout.getLowerZone(), zoneLayout.getUpperZone() })
+            {
+                if (! zone.isActive())
+                    continue;
+
+                if (zone.isUsingChannelAsMemberChannel (channel))
+                {
+                    zoneMasterForChannel[index] = (juce::int8) zone.getMasterChannel();
+                    pitchBendRange[index] = (float) zone.perNotePitchbendRange;
+                }
+                else if (zone.getMasterChannel() == channel)
+                {
+                    pitchBendRange[index] = (float) zone.masterPitchbendRange;
+                }
+            }
+        }
+    }
+
+    /** Member counts and bend ranges of both zones, to spot changes made by MIDI. */
+    std::array<int, 6> summariseZones() const noexcept
+    {
+        auto lower = zoneLayout.getLowerZone();
+        auto upper = zoneLayout.getUpperZone();
+
+        return { { lower.numMemberChannels, lower.perNotePitchbendRange, lower.masterPitchbendRange,
+                   upper.numMemberChannels, upper.perNotePitchbendRange, upper.masterPitchbendRange } };
+    }
+
+    /** Records the last pressure, pitch bend and timbre per note and channel,
+        and follows MPE Configuration Messages. Note-ons clear their note's
+        pressure here too, so poly aftertouch that follows its note-on in the
+        same block survives the note starting. If the block held any
+        expression, renderMidi gets a copy of it without and this returns true.
+        Only under lock.
+    */
+    bool extractExpression (const juce::MidiBuffer& inputMidi) noexcept
+    {
+        auto foundExpression = false;
+
+        for (const auto metadata : inputMidi)
+        {
+            auto message = metadata.getMessage();
+            auto channel = message.getChannel();
+
+            if (channel <= 0)
+                continue;
+
+            auto& expression = channelExpression[(size_t) channel - 1];
+
+            if (message.isNoteOn())
+            {
+                setNotePressureFromBlock (channel, message.getNoteNumber(), 0.0f);
+                continue;
+            }
+
+            if (message.isAftertouch())
+                setNotePressureFromBlock (channel, message.getNoteNumber(), (float) message.getAfterTouchValue() / 127.0f);
+            else if (message.isChannelPressure())
+                expression.pressure = (float) message.getChannelPressureValue() / 127.0f;
+            else if (message.isPitchWheel())
+                expression.pitchBendSemitones = pitchBendRange[(size_t) channel - 1] * (float) (message.getPitchWheelValue() - 8192) / 8192.0f;
+            else if (message.isControllerOfType (timbreController))
+                expression.timbre = (float) message.getControllerValue() / 127.0f;
+            else
+            {
+                if (message.isController())
+                {
+                    zoneLayout.processNextMidiEvent (message);
+
+                    if (summariseZones() != zonesInUse)
+                        updateChannelRoles();
+                }
+
+                continue;
+            }
+
+            foundExpression = true;
+        }
+
+        if (! foundExpression)
+            return false;
+
+        renderMidi.clear();
+
+        for (const auto metadata : inputMidi)
+            if (! isExpression (metadata.data, metadata.numBytes))
+                renderMidi.addEvent (metadata.data, metadata.numBytes, metadata.samplePosition);
+
+        return true;
+    }
+
+    static bool isExpression (const juce::uint8* data, int numBytes) noexcept
+    {
+        auto status = data[0] & 0xf0;
+
+        return status == 0xa0 || status == 0xd0 || status == 0xe0
+                || (status == 0xb0 && numBytes > 1 && data[1] == timbreController);
+    }
+
+    void removeHeldNote (int midiNoteNumber) noexcept
+    {
+        auto end = heldNotes.begin() + numHeld;
+        auto found = std::find (heldNotes.begin(), end, midiNoteNumber);
+
+        if (found != end)
+        {
+            std::copy (found + 1, end, found);
+            --numHeld;
+        }
+    }
+
+    void updateVoiceGlide()
+    {
+        for (auto* voice : sineVoices)
+            voice->setGlide (voiceMode != VoiceMode::poly, glideSeconds);
+    }
+
+    /** Voices in the middle of a cached start carry on live first. */
+    void prepareRenderCache()
+    {
+        for (auto& state : voiceStates)
+            state.leaveCache();
+
+        renderCache.prepare (renderCacheEntries, (int) (renderCacheMilliseconds * 0.001 * getSampleRate()));
+    }
+
+    ScratchArena& arena;
+    SineWaveVoiceState::RenderCache renderCache;
+    std::vector<SineWaveVoiceState> voiceStates;
+    std::vector<SineWaveVoice*> sineVoices;
+
+    static constexpr int timbreController = 74;
+
+    // one entry per channel, plus a neutral one for notes outside any MPE zone
+    static constexpr size_t noMasterChannel = 16;
+
+    ExpressionRouting expressionRouting;
+    std::array<std::array<float, 128>, 16> notePressure;
+    std::array<std::array<bool, 128>, 16> notePressureFromBlock {};
+    bool pressureSetThisBlock = false;
+    std::array<ChannelExpression, 17> channelExpression;
+    std::array<std::array<juce::int8, 128>, 16> voiceForNote;
+    juce::MidiBuffer renderMidi;
+
+    juce::MPEZoneLayout zoneLayout;
+    std::array<int, 6> zonesInUse;
+    std::array<juce::int8, 16> zoneMasterForChannel;
+    std::array<float, 16> pitchBendRange;
+
+    VoiceMode voiceMode = VoiceMode::poly;
+    SineWaveSound::VelocityCurve velocityCurve = SineWaveSound::VelocityCurve::linear;
+    double glideSeconds = 0.0;
+    float lastVelocity = 0.0f;
+
+    std::array<int, 128> heldNotes;
+    int numHeld = 0;
+
+    mutable std::atomic<juce::int64> numVoiceSteals { 0 };
+    std::atomic<juce::int64> numEarlyReleases { 0 };
+
+    static constexpr float defaultSilenceFloorDb = -80.0f;
+    static constexpr int defaultSilentBlocks = 4;
+
+    float silenceFloorDb = defaultSilenceFloorDb;
+    int silentBlocksToRelease = defaultSilentBlocks;
+
+    double renderCacheMilliseconds = 0.0;
+    int renderCacheEntries = 0;
+};
+
+//==============================================================================
+/** Plays a MIDI file through its own SineWaveSynth on a background thread.
+    The thread renders renderBlockSize samples at a time into a FIFO, up to
+    renderAheadSeconds ahead of the audio callback, which then only copies the
+    result out. However heavy the sequence gets, the callback's cost stays
+    the same, while live input still goes through the main synth at device
+    latency.
+*/
+class SequencePlayer   : private juce::Thread
+{
+public:
+    static constexpr int renderBlockSize = 4096;
+    static constexpr double renderAheadSeconds = 0.5;
+
+    SequencePlayer (int numVoices, int numChannels, WavetableManager& wavetableManager)
+        : juce::Thread ("Sequence render-ahead"),
+          synth (numVoices, arena),
+          renderBuffer (numChannels, renderBlockSize)
+    {
+        synth.addSound (sineSound = new SineWaveSound (&wavetableManager));
+    }
+
+    ~SequencePlayer() override
+    {
+        stop();
+    }
+
+    /** Not real-time safe; call from prepareToPlay. Stops anything playing. */
+    void prepare (double newSampleRate, size_t newMidiBufferBytes)
+    {
+        stop();
+
+        sampleRate = newSampleRate;
+        midiBufferBytes = newMidiBufferBytes;
+
+        synth.prepare (sampleRate, midiBufferBytes);
+
+        for (auto i = 0; i < synth.getNumSounds(); ++i)
+            if (auto* sound = dynamic_cast<SineWaveSound*> (synth.getSound (i).get()))
+                sound->prepareToPlay (sampleRate);
+
+        arena.prepare (SineWaveVoiceState::scratchBytes);
+        blockMidi.ensureSize (midiBufferBytes);
+        fifo.prepare (renderBuffer.getNumChannels(), (int) std::ceil (renderAheadSeconds * sampleRate) + renderBlockSize);
+    }
+
+    /** Message thread: loads a standard MIDI file and starts playing it with
+        the same settings as liveSynth and the same patch settings, such as
+        the oscillator, as liveSound. Returns false if it can't be read.
+    */
+    bool play (const juce::File& file, const SineWaveSynth& liveSynth, const SineWaveSound& liveSound)
+    {
+        juce::FileInputStream stream (file);
+        juce::MidiFile midiFile;
+
+        if (! stream.openedOk() || ! midiFile.readFrom (stream))
+            return false;
+
+        midiFile.convertTimestampTicksToSeconds();
+        stop();
+
+        sequence.clear();
+
+        for (auto track = 0; track < midiFile.getNumTracks(); ++track)
+            sequence.addSequence (*midiFile.getTrack (track), 0.0);
+
+        sequence.sort();
+
+        matchSettings (liveSynth, liveSound);
+        synth.allNotesOff (0, false);
+
+        nextEvent = 0;
+        renderPosition = 0;
+        finishedRendering = false;
+
+        {
+            const juce::SpinLock::ScopedLockType sl (fifoLock);
+            fifo.reset();
+            playing = true;
+        }
+
+        startThread();
+        return true;
+    }
+
+    void stop()
+    {
+        stopThread (2000);
+
+        const juce::SpinLock::ScopedLockType sl (fifoLock);
+        playing = false;
+        fifo.reset();
+    }
+
+    bool isPlaying() const noexcept                    { return playing; }
+
+    /** Callbacks that found less rendered than they needed. */
+    juce::int64 getNumUnderruns() const noexcept       { return underruns; }
+
+    /** Audio thread: adds the next numSamples of the sequence into buffer.
+        Anything the thread hasn't rendered in time is left silent and counted.
+    */
+    void addNextBlock (juce::AudioBuffer<float>& buffer, int startSample, int numSamples) noexcept
+    {
+        const juce::SpinLock::ScopedTryLockType tl (fifoLock);
+
+        if (! tl.isLocked() || ! playing)
+            return;
+
+        // read before popping, so a final block pushed in between isn't lost
+        auto renderingDone = finishedRendering.load();
+
+        if (fifo.popAndAdd (buffer, startSample, numSamples) < numSamples)
+        {
+            if (renderingDone)
+                playing = false;
+            else
+                ++underruns;
+        }
+    }
+
+    void addMemoryUsage (MemoryUsage& usage) const
+    {
+        for (auto i = 0; i < synth.getNumSounds(); ++i)
+            if (auto* sound = dynamic_cast<SineWaveSound*> (synth.getSound (i).get()))
+                usage.wavetables += sound->getMemoryUsage();
+
+        usage.voices += synth.getVoiceMemoryUsage();
+        usage.midiBuffers += MemoryUsage::getAllocatedBytes (blockMidi) + synth.getMidiMemoryUsage();
+        usage.scratchBuffers += arena.getMemoryUsage() + fifo.getMemoryUsage()
+                                  + (size_t) renderBuffer.getNumChannels() * (size_t) renderBuffer.getNumSamples() * sizeof (float);
+    }
+
+private:
+    void matchSettings (const SineWaveSynth& liveSynth, const SineWaveSound& liveSound)
+    {
+        synth.setVoiceMode (liveSynth.getVoiceMode());
+        synth.setGlideTime (liveSynth.getGlideTime());
+        synth.setVelocityCurve (liveSynth.getVelocityCurve());
+        synth.setOscillator (*sineSound, liveSound.getOscillator());
+        synth.setExpressionRouting (liveSynth.getExpressionRouting());
+        synth.setMpeZones (liveSynth.getNumMpeMemberChannels (true), liveSynth.getNumMpeMemberChannels (false));
+        synth.setSilenceRelease (liveSynth.getSilenceFloorDb(), liveSynth.getSilentBlocksToRelease());
+        synth.setRenderCache (liveSynth.getRenderCacheMilliseconds(), liveSynth.getRenderCacheEntries());
+    }
+
+    void run() override
+    {
+        auto waitMilliseconds = juce::jmax (1, (int) (250.0 * renderBlockSize / sampleRate));
+
+        while (! threadShouldExit())
+        {
+            if (finishedRendering || fifo.getFreeSpace() < renderBlockSize)
+                wait (waitMilliseconds);
+            else
+                renderNextBlock();
+        }
+    }
+
+    /** Once the last event has gone in, any notes the file left hanging are
+        released, and rendering stops when every voice has died away.
+    */
+    void renderNextBlock()
+    {
+        auto blockEnd = renderPosition + renderBlockSize;
+        blockMidi.clear();
+
+        for (; nextEvent < sequence.getNumEvents(); ++nextEvent)
+        {
+            const auto& message = sequence.getEventPointer (nextEvent)->message;
+            auto position = (juce::int64) std::llround (message.getTimeStamp() * sampleRate);
+
+            if (position >= blockEnd)
+                break;
+
+            if (! message.isMetaEvent())
+                blockMidi.addEvent (message, (int) juce::jmax ((juce::int64) 0, position - renderPosition));
+        }
+
+        renderBuffer.clear();
+        arena.reset();
+        synth.renderNextBlock (renderBuffer, blockMidi, 0, renderBlockSize);
+        fifo.push (renderBuffer, renderBlockSize);
+
+        renderPosition = blockEnd;
+
+        if (nextEvent >= sequence.getNumEvents())
+        {
+            if (synth.isAnyVoiceActive())
+                synth.allNotesOff (0, true);
+            else
+                finishedRendering = true;
+        }
+    }
+
+    ScratchArena arena;
+    SineWaveSynth synth;
+    SineWaveSound* sineSound = nullptr;  // owned by synth
+    juce::AudioBuffer<float> renderBuffer;
+    juce::MidiBuffer blockMidi;
+    AudioSampleFifo fifo;
+    size_t midiBufferBytes = 0;
+
+    juce::MidiMessageSequence sequence;
+    int nextEvent = 0;
+    juce::int64 renderPosition = 0;
+    double sampleRate = 44100.0;
+
+    juce::SpinLock fifoLock;
+    std::atomic<bool> playing { false }, finishedRendering { false };
+    std::atomic<juce::int64> underruns { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SequencePlayer)
+};
+
+//==============================================================================
+class SynthAudioSource   : public juce::AudioSource,
+                           private juce::MidiKeyboardStateListener
+{
+public:
+    /** Output channels the arena is sized for, as opened by MainContentComponent. */
+    static constexpr int numOutputChannels = 2;
+    /** Enough for a full 15-channel MPE zone. */
+    static constexpr int numVoices = 16;
+
+    SynthAudioSource (juce::MidiKeyboardState& keyState)
+        : keyboardState (keyState),
+          synth (numVoices, scratchArena)
+    {
+        StartupProfile::getInstance().mark ("synth construction");
+        synth.addSound (sineSound = new SineWaveSound (&wavetableManager));
+        StartupProfile::getInstance().mark ("wavetables");
+        keyboardState.addListener (this);
+    }
+
+    ~SynthAudioSource() override
+    {
+        keyboardState.removeListener (this);
+    }
+
+    void setUsingSineWaveSound()
+    {
+        synth.clearSounds();
+    }
+
+    void prepareToPlay (int samplesPerBlockExpected, double sampleRate) override
+    {
+        synth.prepare (sampleRate, midiBufferBytes);
+
+        for (auto i = 0; i < synth.getNumSounds(); ++i)
+            if (auto* sound = dynamic_cast<SineWaveSound*> (synth.getSound (i).get()))
+                sound->prepareToPlay (sampleRate);
+
+        midiCollector.reset (sampleRate);
+        arpeggiator.prepare (sampleRate, juce::jmax (samplesPerBlockExpected, maximumDeviceBlockSize), midiBufferBytes);
+        masterEffects.prepare (sampleRate);
+        sequencePlayer.prepare (sampleRate, midiBufferBytes);
+        incomingMidi.ensureSize (midiBufferBytes);
+
+        // the voices and then the effects each rewind what they take, so only the
+        // biggest of them has to fit, and neither depends on the block size
+        scratchArena.prepare (juce::jmax (SineWaveVoiceState::scratchBytes, MasterEffects::scratchBytes));
+
+        currentSampleRate = sampleRate;
+        currentBlockSize = samplesPerBlockExpected;
+
+        const juce::SpinLock::ScopedLockType sl (recorderLock);
+
+        if (recorder != nullptr)
+            recorder->recordPrepare (getSessionPrepare());
+    }
+
+    void releaseResources() override {}
+
+    void getNextAudioBlock (const juce::AudioSourceChannelInfo& bufferToFill) override
+    {
+        StartupProfile::getInstance().markFirstAudio();
+        bufferToFill.clearActiveBufferRegion();
+        scratchArena.reset();
+
+        incomingMidi.clear();
+        midiCollector.removeNextBlockOfMessages (incomingMidi, bufferToFill.numSamples);
+
+        ++blocksRendered;
+        midiEventsReceived += incomingMidi.getNumEvents();
+
+        auto keyboardEventsArrived = keyboardEventsPending.exchange (false);
+
+        if (idleFastPath && incomingMidi.isEmpty() && ! keyboardEventsArrived && isIdle())
+        {
+            // nothing renders, so the settings are only read if a recorder will log them
+            recordBlock (bufferToFill, true);
+            return;
+        }
+
+        keyboardState.processNextMidiBuffer (incomingMidi, bufferToFill.startSample,
+                                             bufferToFill.numSamples, true);
+
+        arpeggiator.process (incomingMidi, bufferToFill.startSample, bufferToFill.numSamples);
+
+        {
+            // the synth's setters take this lock, so the settings logged are the ones rendered with
+            const juce::ScopedLock sl (synth.getLock());
+
+            captureSettings();
+
+            synth.renderNextBlock (*bufferToFill.buffer, incomingMidi,
+                                   bufferToFill.startSample, bufferToFill.numSamples);
+        }
+
+        // before the sequence goes in: the log has no record of it, so replay couldn't match it
+        recordBlock (bufferToFill);
+
+        sequencePlayer.addNextBlock (*bufferToFill.buffer, bufferToFill.startSample, bufferToFill.numSamples);
+
+        masterEffects.process (*bufferToFill.buffer, bufferToFill.startSample, bufferToFill.numSamples, scratchArena);
+
+        samplesSinceVoicesStopped = synth.isAnyVoiceActive() ? 0 : samplesSinceVoicesStopped + bufferToFill.numSamples;
+    }
+
+    /** With nothing sounding, no effect tail left and no MIDI arriving, the
+        callback only clears the buffer and drains the collector, skipping the
+        keyboard state, arpeggiator, synth and effects. On by default.
+    */
+    void setIdleFastPathEnabled (bool shouldBeEnabled) noexcept    { idleFastPath = shouldBeEnabled; }
+
+    /** Renders a block from MIDI captured by a SessionRecorder, skipping the
+        collector, keyboard state and arpeggiator that had already run live.
+        Returns the checksum of the synth's output, taken before the effects
+        just as the recorder takes it live.
+    */
+    juce::uint32 renderRecordedBlock (const juce::AudioSourceChannelInfo& bufferToFill, const juce::MidiBuffer& recordedMidi)
+    {
+        bufferToFill.clearActiveBufferRegion();
+        scratchArena.reset();
+        ++blocksRendered;
+
+        synth.renderNextBlock (*bufferToFill.buffer, recordedMidi,
+                               bufferToFill.startSample, bufferToFill.numSamples);
+
+        auto checksum = SessionLog::checksum (*bufferToFill.buffer, bufferToFill.startSample, bufferToFill.numSamples);
+
+        masterEffects.process (*bufferToFill.buffer, bufferToFill.startSample, bufferToFill.numSamples, scratchArena);
+        return checksum;
+    }
+
+    //==============================================================================
+    /** Starts capturing every block's MIDI to a log for SessionReplay. For a
+        bit-exact replay, start recording while nothing is sounding.
+    */
+    void startRecording (const juce::File& file)
+    {
+        auto newRecorder = std::make_unique<SessionRecorder> (file);
+        newRecorder->recordPrepare (getSessionPrepare());
+
+        const juce::SpinLock::ScopedLockType sl (recorderLock);
+        std::swap (recorder, newRecorder);
+    }
+
+    void stopRecording()
+    {
+        std::unique_ptr<SessionRecorder> oldRecorder;
+
+        {
+            const juce::SpinLock::ScopedLockType sl (recorderLock);
+            std::swap (recorder, oldRecorder);
+        }
+    }
+
+    bool isRecording() const noexcept
+    {
+        return recorder != nullptr;
+    }
+
+    const ScratchArena& getScratchArena() const noexcept    { return scratchArena; }
+
+    /** Bytes the engine has actually allocated, so anything that grows on the
+        audio thread shows up. Call from the message thread.
+    */
+    MemoryUsage getMemoryUsage() const
+    {
+        MemoryUsage usage;
+
+        for (auto i = 0; i < synth.getNumSounds(); ++i)
+            if (auto* sound = dynamic_cast<SineWaveSound*> (synth.getSound (i).get()))
+                usage.wavetables += sound->getMemoryUsage();
+
+        usage.voices = synth.getVoiceMemoryUsage();
+        usage.midiBuffers = MemoryUsage::getAllocatedBytes (incomingMidi) + arpeggiator.getMemoryUsage()
+                              + synth.getMidiMemoryUsage();
+        usage.scratchBuffers = scratchArena.getMemoryUsage();
+        usage.effects = masterEffects.getMemoryUsage();
+        sequencePlayer.addMemoryUsage (usage);
+
+        if (recorder != nullptr)
+            usage.scratchBuffers += recorder->getMemoryUsage();
+
+        return usage;
+    }
+
+    juce::MidiMessageCollector* getMidiCollector()
+    {
+        return &midiCollector;
+    }
+
+    /** The MIDI the last block was rendered from, after the keyboard state and
+        arpeggiator. Only for the thread that calls getNextAudioBlock().
+    */
+    const juce::MidiBuffer& getLastBlockMidi() const noexcept
+    {
+        return incomingMidi;
+    }
+
+    struct Statistics
+    {
+        juce::int64 blocksRendered, midiEventsReceived, voiceSteals, earlyReleases, renderCacheHits, sequenceUnderruns;
+        juce::int64 arpeggiatorDrops;
+    };
+
+    /** Running totals since construction; safe to call from any thread. */
+    Statistics getStatistics() const noexcept
+    {
+        return { blocksRendered.load(), midiEventsReceived.load(), synth.getNumVoiceSteals(), synth.getNumEarlyReleases(),
+                 synth.getNumRenderCacheHits(), sequencePlayer.getNumUnderruns(), arpeggiator.getNumDroppedEvents() };
+    }
+
+    Arpeggiator& getArpeggiator()
+    {
+        return arpeggiator;
+    }
+
+    MasterEffects& getMasterEffects()
+    {
+        return masterEffects;
+    }
+
+    /** Plays a MIDI file through the render-ahead SequencePlayer, mixed in
+        with the live input. Call from the message thread.
+    */
+    bool playSequence (const juce::File& file)    { return sequencePlayer.play (file, synth, *sineSound); }
+    void stopSequence()                           { sequencePlayer.stop(); }
+    bool isPlayingSequence() const noexcept       { return sequencePlayer.isPlaying(); }
+
+    /** The arpeggiator and the synced delay share one tempo. */
+    void setTempo (double bpm) noexcept
+    {
+        arpeggiator.setTempo (bpm);
+        masterEffects.setTempo (bpm);
+    }
+
+    SineWaveSynth& getSynth()
+    {
+        return synth;
+    }
+
+    /** The patch the live synth plays; settings such as the oscillator belong to it. */
+    SineWaveSound& getSound()
+    {
+        return *sineSound;
+    }
+
+    /** Shared by every sound here, including the sequence player's. */
+    WavetableManager& getWavetableManager()
+    {
+        return wavetableManager;
+    }
+
+private:
+    static constexpr size_t midiBufferBytes = 8192;
+
+    /** Devices may deliver blocks bigger than they announced, so the arpeggiator
+        is prepared for at least this many samples.
+    */
+    static constexpr int maximumDeviceBlockSize = 8192;
+
+    juce::MidiKeyboardState& keyboardState;
+    ScratchArena scratchArena;
+    WavetableManager wavetableManager;
+    SineWaveSynth synth;
+    SineWaveSound* sineSound = nullptr;  // owned by synth
+    juce::MidiMessageCollector midiCollector;
+    juce::MidiBuffer incomingMidi;
+    Arpeggiator arpeggiator;
+    MasterEffects masterEffects;
+    SequencePlayer sequencePlayer { numVoices, numOutputChannels, wavetableManager };
+
+    std::atomic<juce::int64> blocksRendered { 0 }, midiEventsReceived { 0 };
+
+    std::atomic<bool> idleFastPath { true }, keyboardEventsPending { false };
+    int samplesSinceVoicesStopped = 0;
+
+    bool isIdle() const noexcept
+    {
+        return arpeggiator.isIdle() && ! synth.isAnyVoiceActive() && ! sequencePlayer.isPlaying()
+                && samplesSinceVoicesStopped >= masterEffects.getTailSamples();
+    }
+
+    /** The on-screen keyboard queues its events inside keyboardState, so this
+        is how the audio thread knows there is something to collect.
+    */
+    void handleNoteOn (juce::MidiKeyboardState*, int, int, float) override     { keyboardEventsPending = true; }
+    void handleNoteOff (juce::MidiKeyboardState*, int, int, float) override    { keyboardEventsPending = true; }
+
+    /** Audio thread: what this block is about to render with, for a recorder
+        to log if it has changed. Rendering blocks call it under the synth lock
+        they already hold; idle ones only when something is recording.
+    */
+    void captureSettings() noexcept
+    {
+        const juce::ScopedLock sl (synth.getLock());
+        blockSettings = getSessionSettings();
+    }
+
+    void recordBlock (const juce::AudioSourceChannelInfo& bufferToFill, bool settingsNeedCapturing = false)
+    {
+        const juce::SpinLock::ScopedTryLockType tl (recorderLock);
+
+        if (! tl.isLocked() || recorder == nullptr)
+            return;
+
+        if (settingsNeedCapturing)
+            captureSettings();
+
+        recorder->recordBlock (incomingMidi, bufferToFill.startSample, bufferToFill.numSamples,
+                               SessionLog::checksum (*bufferToFill.buffer, bufferToFill.startSample, bufferToFill.numSamples),
+                               blockSettings);
+    }
+
+    SessionLog::Settings getSessionSettings() const noexcept
+    {
+        return { (juce::int32) synth.getVoiceMode(), synth.getGlideTime(),
+                 (juce::int32) synth.getVelocityCurve(), (juce::int32) sineSound->getOscillator(),
+                 synth.getSilenceFloorDb(), synth.getSilentBlocksToRelease(),
+                 synth.getRenderCacheMilliseconds(), synth.getRenderCacheEntries(),
+                 synth.getNumMpeMemberChannels (true), synth.getNumMpeMemberChannels (false),
+                 masterEffects.isChorusEnabled(), masterEffects.isDelayEnabled(), masterEffects.getTempo(),
+                 masterEffects.getDelayBeats(), masterEffects.getDelayFeedback(), masterEffects.getDelayMix() };
+    }
+
+    SessionLog::Prepare getSessionPrepare() const
+    {
+        return { currentSampleRate, currentBlockSize, getSessionSettings() };
+    }
+
+    double currentSampleRate = 44100.0;
+    int currentBlockSize = 512;
+
+    juce::SpinLock recorderLock;
+    std::unique_ptr<SessionRecorder> recorder;
+    SessionLog::Settings blockSettings {};
+};
+
+//==============================================================================
+class MainContentComponent   : public juce::AudioAppComponent,
+                               private juce::Timer
+{
+public:
+    MainContentComponent()
+        : synthAudioSource  (keyboardState),
+          keyboardComponent (keyboardState, juce::MidiKeyboardComponent::horizontalKeyboard)
+    {
+        addAndMakeVisible (arpeggiatorToggle);
+        arpeggiatorToggle.onClick = [this] { synthAudioSource.getArpeggiator().setEnabled (arpeggiatorToggle.getToggleState()); };
+
+        addAndMakeVisible (arpeggiatorRateList);
+        arpeggiatorRateList.addItem ("1/4",  (int) Arpeggiator::Rate::quarter);
+        arpeggiatorRateList.addItem ("1/8",  (int) Arpeggiator::Rate::eighth);
+        arpeggiatorRateList.addItem ("1/16", (int) Arpeggiator::Rate::sixteenth);
+        arpeggiatorRateList.addItem ("1/32", (int) Arpeggiator::Rate::thirtySecond);
+        arpeggiatorRateList.addItem ("1/64", (int) Arpeggiator::Rate::sixtyFourth);
+        arpeggiatorRateList.onChange = [this] { synthAudioSource.getArpeggiator().setRate ((Arpeggiator::Rate) arpeggiatorRateList.getSelectedId()); };
+        arpeggiatorRateList.setSelectedId ((int) Arpeggiator::Rate::sixteenth);
+
+        addAndMakeVisible (tempoSlider);
+        tempoSlider.setSliderStyle (juce::Slider::IncDecButtons);
+        tempoSlider.setRange (Arpeggiator::minimumTempo, Arpeggiator::maximumTempo, 1.0);
+        tempoSlider.setTextValueSuffix (" BPM");
+        tempoSlider.onValueChange = [this] { synthAudioSource.setTempo (tempoSlider.getValue()); };
+        tempoSlider.setValue (120.0);
+
+        addAndMakeVisible (voiceModeList);
+        voiceModeList.addItem ("Poly",   (int) SineWaveSynth::VoiceMode::poly);
+        voiceModeList.addItem ("Mono",   (int) SineWaveSynth::VoiceMode::mono);
+        voiceModeList.addItem ("Legato", (int) SineWaveSynth::VoiceMode::legato);
+        voiceModeList.onChange = [this] { synthAudioSource.getSynth().setVoiceMode ((SineWaveSynth::VoiceMode) voiceModeList.getSelectedId()); };
+        voiceModeList.setSelectedId ((int) SineWaveSynth::VoiceMode::poly);
+
+        addAndMakeVisible (glideSlider);
+        glideSlider.setSliderStyle (juce::Slider::LinearHorizontal);
+        glideSlider.setTextBoxStyle (juce::Slider::TextBoxRight, false, 60, 20);
+        glideSlider.setRange (0.0, 1.0, 0.01);
+        glideSlider.setTextValueSuffix (" s");
+        glideSlider.onValueChange = [this] { synthAudioSource.getSynth().setGlideTime (glideSlider.getValue()); };
+
+        addAndMakeVisible (playButton);
+        playButton.onClick = [this] { togglePlayback(); };
+
+        addAndMakeVisible (recordButton);
+        recordButton.setClickingTogglesState (true);
+        recordButton.onClick = [this] { updateRecording(); };
+
+        addAndMakeVisible (velocityCurveList);
+        velocityCurveList.addItem ("Linear", (int) SineWaveSound::VelocityCurve::linear);
+        velocityCurveList.addItem ("Soft",   (int) SineWaveSound::VelocityCurve::soft);
+        velocityCurveList.addItem ("Hard",   (int) SineWaveSound::VelocityCurve::hard);
+        velocityCurveList.addItem ("Fixed",  (int) SineWaveSound::VelocityCurve::fixed);
+        velocityCurveList.onChange = [this] { synthAudioSource.getSynth().setVelocityCurve ((SineWaveSound::VelocityCurve) velocityCurveList.getSelectedId()); };
+        velocityCurveList.setSelectedId ((int) SineWaveSound::VelocityCurve::linear);
+
+        addAndMakeVisible (mpeToggle);
+        mpeToggle.onClick = [this] { synthAudioSource.getSynth().setMpeZones (mpeToggle.getToggleState() ? 15 : 0, 0); };
+
+        addAndMakeVisible (oscillatorList);
+        oscillatorList.addItem ("Wavetable", (int) SineWaveSound::Oscillator::wavetable);
+        oscillatorList.addItem ("Saw",       (int) SineWaveSound::Oscillator::saw);
+        oscillatorList.addItem ("Square",    (int) SineWaveSound::Oscillator::square);
+        oscillatorList.addItem ("Triangle",  (int) SineWaveSound::Oscillator::triangle);
+        oscillatorList.addItem ("Pulse",     (int) SineWaveSound::Oscillator::pulse);
+        oscillatorList.onChange = [this] { synthAudioSource.getSynth().setOscillator (synthAudioSource.getSound(),
+                                                                                     (SineWaveSound::Oscillator) oscillatorList.getSelectedId()); };
+        oscillatorList.setSelectedId ((int) SineWaveSound::Oscillator::wavetable);
+
+        addAndMakeVisible (chorusToggle);
+        chorusToggle.onClick = [this] { synthAudioSource.getMasterEffects().setChorusEnabled (chorusToggle.getToggleState()); };
+
+        addAndMakeVisible (delayToggle);
+        delayToggle.onClick = [this] { synthAudioSource.getMasterEffects().setDelayEnabled (delayToggle.getToggleState()); };
+
+        addAndMakeVisible (memoryLabel);
+
+        addAndMakeVisible (keyboardComponent);
+        StartupProfile::getInstance().mark ("GUI construction");
+
+        setAudioChannels (0, SynthAudioSource::numOutputChannels);
+        StartupProfile::getInstance().mark ("audio device opening");
+
+        setSize (860, 220);
+        startTimer (400);
+    }
+
+    ~MainContentComponent() override
+    {
+        shutdownAudio();
+    }
+
+    void resized() override
+    {
+        arpeggiatorToggle  .setBounds (10,  10, 110, 20);
+        arpeggiatorRateList.setBounds (130, 10, 70,  20);
+        tempoSlider        .setBounds (210, 10, 150, 20);
+        voiceModeList      .setBounds (370, 10, 80,  20);
+        glideSlider        .setBounds (460, 10, getWidth() - 580, 20);
+        playButton         .setBounds (getWidth() - 110, 10, 100, 20);
+        recordButton       .setBounds (10,  40, 110, 20);
+        velocityCurveList  .setBounds (130, 40, 80,  20);
+        mpeToggle          .setBounds (220, 40, 60,  20);
+        chorusToggle       .setBounds (290, 40, 70,  20);
+        delayToggle        .setBounds (370, 40, 60,  20);
+        oscillatorList     .setBounds (440, 40, 90,  20);
+        memoryLabel        .setBounds (540, 40, getWidth() - 550, 20);
+        keyboardComponent  .setBounds (10,  70, getWidth() - 20, getHeight() - 80);
+    }
+
+    void prepareToPlay (int samplesPerBlockExpected, double sampleRate) override
+    {
+        synthAudioSource.prepareToPlay (samplesPerBlockExpected, sampleRate);
+    }
+
+    void getNextAudioBlock (const juce::AudioSourceChannelInfo& bufferToFill) override
+    {
+        synthAudioSource.getNextAudioBlock (bufferToFill);
+    }
+
+    void releaseResources() override
+    {
+        synthAudioSource.releaseResources();
+    }
+
+private:
+    void timerCallback() override
+    {
+        if (! hasGrabbedFocus)
+        {
+			keyboardComponent.setKeyPressBaseOctave(4);
+            keyboardComponent.grabKeyboardFocus();
+            hasGrabbedFocus = true;
+            startTimer (1000);
+        }
+
+        memoryLabel.setText ("Memory: " + synthAudioSource.getMemoryUsage().toString(), juce::dontSendNotification);
+        playButton.setButtonText (synthAudioSource.isPlayingSequence() ? "Stop MIDI file" : "Play MIDI file");
+    }
+
+    void togglePlayback()
+    {
+        if (synthAudioSource.isPlayingSequence())
+        {
+            synthAudioSource.stopSequence();
+            playButton.setButtonText ("Play MIDI file");
+            return;
+        }
+
+        fileChooser = std::make_unique<juce::FileChooser> ("Play a MIDI file", juce::File(), "*.mid;*.midi");
+        fileChooser->launchAsync (juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles,
+                                  [this] (const juce::FileChooser& chooser)
+                                  {
+                                      if (synthAudioSource.playSequence (chooser.getResult()))
+                                          playButton.setButtonText ("Stop MIDI file");
+                                  });
+    }
+
+    /** Sessions go to a fresh file in the user's documents folder; replay them
+        with --replay=<file>.
+    */
+    void updateRecording()
+    {
+        if (recordButton.getToggleState())
+        {
+            auto file = juce::File::getSpecialLocation (juce::File::userDocumentsDirectory)
+                                   .getNonexistentChildFile ("SynthSession", ".synthlog");
+
+            synthAudioSource.startRecording (file);
+            recordButton.setButtonText ("Stop recording");
+        }
+        else
+        {
+            synthAudioSource.stopRecording();
+            recordButton.setButtonText ("Record session");
+        }
+    }
+
+    //==========================================================================
+    juce::MidiKeyboardState keyboardState;
+    SynthAudioSource synthAudioSource;
+    juce::MidiKeyboardComponent keyboardComponent;
+
+    juce::ToggleButton arpeggiatorToggle { "Arpeggiator" };
+    juce::ComboBox arpeggiatorRateList;
+    juce::Slider tempoSlider;
+    juce::ComboBox voiceModeList;
+    juce::ComboBox velocityCurveList;
+    juce::ComboBox oscillatorList;
+    juce::ToggleButton mpeToggle { "MPE" };
+    juce::ToggleButton chorusToggle { "Chorus" }, delayToggle { "Delay" };
+    juce::Slider glideSlider;
+
+    juce::TextButton recordButton { "Record session" };
+    juce::TextButton playButton { "Play MIDI file" };
+    std::unique_ptr<juce::FileChooser> fileChooser;
+    juce::Label memoryLabel;
+
+    bool hasGrabbedFocus = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MainContentComponent)
+};
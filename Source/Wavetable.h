@@ -0,0 +1,329 @@
+/*
+  ==============================================================================
+
+    Wavetable.h
+
+    Band-limited, mipmapped wavetables built from a harmonic recipe. Level 0
+    holds every harmonic; each higher level halves the harmonic count so that
+    notes an octave further up still stay below Nyquist.
+
+    Any level but the last can be evicted to save memory and rebuilt later by
+    a WavetableManager. Voices pin the level they play, so it is never freed
+    under them. Levels embedded in the binary are referred to in place and
+    never evicted. A table can also start with only its last level built and
+    leave the manager to build the others the first time a note asks.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "EmbeddedWavetables.h"
+
+//==============================================================================
+class MipmappedWavetable
+{
+public:
+    /** onDemand builds only the last level here. The rest start evicted, so
+        they need a WavetableManager to build them.
+    */
+    enum class Build
+    {
+        upFront,
+        onDemand
+    };
+
+    /** harmonicWeights[i] is the amplitude of harmonic i + 1. Every level has
+        tableSize samples plus one guard sample equal to the first.
+    */
+    MipmappedWavetable (std::vector<float> weights, int tableSizeToUse, Build build = Build::upFront)
+        : harmonicWeights (std::move (weights)),
+          tableSize (tableSizeToUse)
+    {
+        jassert (! harmonicWeights.empty() && tableSize > 0);
+
+        for (auto maxHarmonic = (int) harmonicWeights.size(); maxHarmonic > 0; maxHarmonic /= 2)
+        {
+            levels.push_back (std::make_unique<Level>());
+            levels.back()->harmonics = maxHarmonic;
+        }
+
+        for (auto& level : levels)
+        {
+            if (build == Build::upFront || level == levels.back())
+            {
+                level->rms = fillLevel (*level);
+            }
+            else
+            {
+                level->rms = getExpectedRms (level->harmonics);
+                level->state = absent;
+            }
+        }
+
+        levelForNote.fill (0);
+    }
+
+    /** Uses levels computed at compile time, without copying them. */
+    explicit MipmappedWavetable (const EmbeddedWavetables::Mipmaps& embedded)
+        : harmonicWeights (embedded.recipe->weights, embedded.recipe->weights + embedded.recipe->numHarmonics),
+          tableSize (EmbeddedWavetables::tableSize)
+    {
+        for (auto i = 0; i < embedded.numLevels; ++i)
+        {
+            const auto& source = *embedded.levels[i];
+
+            // read-only data: nothing may write to these buffers
+            float* channels[] = { const_cast<float*> (source.samples) };
+
+            levels.push_back (std::make_unique<Level>());
+            levels.back()->table.setDataToReferTo (channels, 1, tableSize + 1);
+            levels.back()->harmonics = source.harmonics;
+            levels.back()->rms = (float) std::sqrt (source.sumOfSquares / tableSize);
+            levels.back()->embedded = true;
+        }
+
+        levelForNote.fill (0);
+    }
+
+    //==============================================================================
+    int getNumLevels() const noexcept                                    { return (int) levels.size(); }
+
+    /** Only valid while the level is resident: pinned, or never evicted. */
+    const juce::AudioSampleBuffer& getLevel (int level) const noexcept   { return levels[(size_t) level]->table; }
+
+    /** RMS of one cycle, measured when the level was first built, or worked
+        out from the weights if it was left to be built on demand.
+    */
+    float getRms (int level) const noexcept                              { return levels[(size_t) level]->rms; }
+
+    /** Rebuilds the note -> level lookup for a new sample rate. Each note gets the
+        richest level whose top harmonic is still below Nyquist.
+    */
+    void prepare (double sampleRate)
+    {
+        auto nyquist = sampleRate * 0.5;
+
+        for (auto note = 0; note < 128; ++note)
+        {
+            auto frequency = juce::MidiMessage::getMidiNoteInHertz (note);
+            auto level = 0;
+
+            while (level < getNumLevels() - 1 && levels[(size_t) level]->harmonics * frequency >= nyquist)
+                ++level;
+
+            levelForNote[(size_t) note] = (juce::uint8) level;
+        }
+    }
+
+    /** Bytes of the levels resident now on the heap. Embedded levels live in
+        the binary's read-only data, so like WavetableManager::getResidentBytes()
+        this leaves them out; the manager's residency report lists them apart.
+    */
+    size_t getMemoryUsage() const noexcept
+    {
+        auto numHeapLevels = 0;
+
+        for (auto level = 0; level < getNumLevels(); ++level)
+            if (isResident (level) && ! isEmbedded (level))
+                ++numHeapLevels;
+
+        return sizeof (levelForNote) + (size_t) numHeapLevels * getLevelBytes();
+    }
+
+    size_t getLevelBytes() const noexcept      { return (size_t) (tableSize + 1) * sizeof (float); }
+
+    /** For tables no WavetableManager is evicting from. */
+    const juce::AudioSampleBuffer& getTableForNote (int midiNoteNumber) const noexcept
+    {
+        return getLevel (getLevelForNote (midiNoteNumber));
+    }
+
+    /** The richest level that keeps midiNoteNumber below Nyquist. */
+    int getLevelForNote (int midiNoteNumber) const noexcept
+    {
+        return levelForNote[(size_t) juce::jlimit (0, 127, midiNoteNumber)];
+    }
+
+    //==============================================================================
+    /** Audio thread: pins the level for the note if it is resident, otherwise
+        the nearest resident level above it, which has fewer harmonics and so
+        is still alias-free. The last level is never evicted, so this always
+        succeeds. A missing level is flagged for the manager to rebuild.
+        Never blocks; release the level with releaseLevel().
+    */
+    int acquireLevelForNote (int midiNoteNumber) noexcept
+    {
+        auto wanted = getLevelForNote (midiNoteNumber);
+
+        for (auto level = wanted; level < getNumLevels(); ++level)
+        {
+            if (tryPin (*levels[(size_t) level]))
+                return level;
+
+            if (level == wanted)
+                levels[(size_t) level]->wanted = true;
+        }
+
+        jassertfalse;
+        return getNumLevels() - 1;
+    }
+
+    /** Audio thread: pins the note's own level if it is resident by now, or
+        flags it again and returns -1. For moving a note off a stand-in.
+    */
+    int tryAcquireExactLevelForNote (int midiNoteNumber) noexcept
+    {
+        auto level = getLevelForNote (midiNoteNumber);
+        auto& l = *levels[(size_t) level];
+
+        if (tryPin (l))
+            return level;
+
+        l.wanted = true;
+        return -1;
+    }
+
+    void releaseLevel (int level) noexcept
+    {
+        auto& l = *levels[(size_t) level];
+        l.lastUsed = juce::Time::getMillisecondCounter();
+
+        auto pins = l.state.fetch_sub (1);
+        jassert (pins > 0);
+        juce::ignoreUnused (pins);
+    }
+
+    //==============================================================================
+    // for WavetableManager's worker thread
+
+    bool isEvictable (int level) const noexcept          { return level < getNumLevels() - 1 && ! isEmbedded (level); }
+    bool isEmbedded (int level) const noexcept           { return levels[(size_t) level]->embedded; }
+    bool isResident (int level) const noexcept           { return levels[(size_t) level]->state.load() >= 0; }
+    bool isPinned (int level) const noexcept             { return levels[(size_t) level]->state.load() > 0; }
+    bool isWanted (int level) const noexcept             { return levels[(size_t) level]->wanted.load(); }
+    bool isFullyResident() const noexcept                { return numResidentLevels() == getNumLevels(); }
+    juce::uint32 getLastUsed (int level) const noexcept  { return levels[(size_t) level]->lastUsed.load(); }
+
+    /** Frees an unpinned level. Returns false if it is pinned or not resident. */
+    bool evict (int level)
+    {
+        auto& l = *levels[(size_t) level];
+        auto unpinned = 0;
+
+        if (! isEvictable (level) || ! l.state.compare_exchange_strong (unpinned, busy))
+            return false;
+
+        l.table.setSize (1, 0);
+        l.state = absent;
+        return true;
+    }
+
+    /** Builds an evicted or not yet built level. Returns false if it was already resident. */
+    bool rebuild (int level)
+    {
+        auto& l = *levels[(size_t) level];
+        auto expected = absent;
+
+        if (! l.state.compare_exchange_strong (expected, busy))
+            return false;
+
+        fillLevel (l);
+        l.lastUsed = juce::Time::getMillisecondCounter();
+        l.wanted = false;
+        l.state = 0;
+        return true;
+    }
+
+private:
+    /** state counts pins while the level is resident; otherwise it is absent,
+        or busy while the worker frees or builds it.
+    */
+    static constexpr int absent = -1, busy = -2;
+
+    struct Level
+    {
+        juce::AudioSampleBuffer table;
+        int harmonics = 0;
+        float rms = 0.0f;
+        bool embedded = false;
+
+        std::atomic<int> state { 0 };
+        std::atomic<bool> wanted { false };
+        std::atomic<juce::uint32> lastUsed { 0 };
+    };
+
+    static bool tryPin (Level& level) noexcept
+    {
+        auto pins = level.state.load();
+
+        while (pins >= 0)
+        {
+            if (level.state.compare_exchange_weak (pins, pins + 1))
+            {
+                level.lastUsed = juce::Time::getMillisecondCounter();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    int numResidentLevels() const noexcept
+    {
+        auto count = 0;
+
+        for (auto level = 0; level < getNumLevels(); ++level)
+            if (isResident (level))
+                ++count;
+
+        return count;
+    }
+
+    /** Harmonics are orthogonal over a cycle, so their powers add. */
+    float getExpectedRms (int harmonics) const noexcept
+    {
+        auto sumOfSquares = 0.0;
+
+        for (auto harmonic = 0; harmonic < harmonics; ++harmonic)
+            sumOfSquares += harmonicWeights[(size_t) harmonic] * harmonicWeights[(size_t) harmonic];
+
+        return (float) std::sqrt (sumOfSquares * 0.5);
+    }
+
+    /** Returns the RMS of the filled cycle. */
+    float fillLevel (Level& level)
+    {
+        auto& table = level.table;
+        table.setSize (1, tableSize + 1);
+        auto* samples = table.getWritePointer (0);
+
+        table.clear();
+
+        for (auto harmonic = 1; harmonic <= level.harmonics; ++harmonic)
+        {
+            auto weight = harmonicWeights[(size_t) harmonic - 1];
+            auto angleDelta = juce::MathConstants<double>::twoPi * harmonic / (double) tableSize;
+
+            for (auto i = 0; i < tableSize; ++i)
+                samples[i] += weight * (float) std::sin (angleDelta * i);
+        }
+
+        samples[tableSize] = samples[0];
+
+        auto sumOfSquares = 0.0;
+
+        for (auto i = 0; i < tableSize; ++i)
+            sumOfSquares += samples[i] * samples[i];
+
+        return (float) std::sqrt (sumOfSquares / tableSize);
+    }
+
+    std::vector<float> harmonicWeights;
+    int tableSize;
+    std::vector<std::unique_ptr<Level>> levels;
+    std::array<juce::uint8, 128> levelForNote;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MipmappedWavetable)
+};
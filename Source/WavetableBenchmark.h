@@ -0,0 +1,316 @@
+/*
+  ==============================================================================
+
+    WavetableBenchmark.h
+
+    Offline sweep of wavetable size against note frequency and voice count,
+    reporting render cost, cache behaviour and interpolation error. Run it with
+    --benchmark-wavetables [--min-table-bits=N] [--max-table-bits=N]
+    [--notes=33,69,105] [--voices=1,8,32]; see Main.cpp.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <iostream>
+#include "CommandLineOptions.h"
+
+#if JUCE_LINUX
+ #include <linux/perf_event.h>
+ #include <sys/ioctl.h>
+ #include <sys/syscall.h>
+ #include <unistd.h>
+#endif
+
+//==============================================================================
+/** Hardware counters for the calling thread via perf_event_open. Counters the
+    kernel or CPU won't give us (containers, VMs, non-Linux) report as unavailable.
+*/
+class PerfCounters
+{
+public:
+    enum Counter
+    {
+        cycles = 0,
+        l1dReads,
+        l1dMisses,
+        llcReads,
+        llcMisses,
+        numCounters
+    };
+
+    PerfCounters()
+    {
+        fds.fill (-1);
+        values.fill (0);
+
+       #if JUCE_LINUX
+        auto cacheConfig = [] (juce::uint64 cache, juce::uint64 result)
+        {
+            return cache | ((juce::uint64) PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+        };
+
+        open (cycles,    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        open (l1dReads,  PERF_TYPE_HW_CACHE, cacheConfig (PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_ACCESS));
+        open (l1dMisses, PERF_TYPE_HW_CACHE, cacheConfig (PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS));
+        open (llcReads,  PERF_TYPE_HW_CACHE, cacheConfig (PERF_COUNT_HW_CACHE_LL,  PERF_COUNT_HW_CACHE_RESULT_ACCESS));
+        open (llcMisses, PERF_TYPE_HW_CACHE, cacheConfig (PERF_COUNT_HW_CACHE_LL,  PERF_COUNT_HW_CACHE_RESULT_MISS));
+       #endif
+    }
+
+    ~PerfCounters()
+    {
+       #if JUCE_LINUX
+        for (auto fd : fds)
+            if (fd >= 0)
+                close (fd);
+       #endif
+    }
+
+    bool isAvailable (Counter counter) const noexcept    { return fds[(size_t) counter] >= 0; }
+    juce::uint64 get (Counter counter) const noexcept    { return values[(size_t) counter]; }
+
+    void start()
+    {
+       #if JUCE_LINUX
+        for (auto fd : fds)
+        {
+            if (fd >= 0)
+            {
+                ioctl (fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl (fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+       #endif
+    }
+
+    void stop()
+    {
+       #if JUCE_LINUX
+        for (size_t i = 0; i < fds.size(); ++i)
+        {
+            if (fds[i] >= 0)
+            {
+                ioctl (fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+                if (read (fds[i], &values[i], sizeof (values[i])) != (ssize_t) sizeof (values[i]))
+                    values[i] = 0;
+            }
+        }
+       #endif
+    }
+
+private:
+   #if JUCE_LINUX
+    void open (Counter counter, juce::uint32 type, juce::uint64 config)
+    {
+        perf_event_attr attr;
+        std::memset (&attr, 0, sizeof (attr));
+        attr.size = sizeof (attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        fds[(size_t) counter] = (int) syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+   #endif
+
+    std::array<int, numCounters> fds;
+    std::array<juce::uint64, numCounters> values;
+
+    JUCE_DECLARE_NON_COPYABLE (PerfCounters)
+};
+
+//==============================================================================
+class WavetableBenchmark
+{
+public:
+    struct Options
+    {
+        int minTableBits = 8, maxTableBits = 24;
+        double sampleRate = 48000.0;
+        double secondsPerRun = 1.0;
+        int blockSize = 512;
+        std::vector<int> notes { 33, 69, 105 };
+        std::vector<int> voiceCounts { 1, 8, 32 };
+
+        static Options fromCommandLine (const juce::StringArray& args)
+        {
+            Options o;
+            o.minTableBits  = getCommandLineOption (args, "--min-table-bits", o.minTableBits);
+            o.maxTableBits  = getCommandLineOption (args, "--max-table-bits", o.maxTableBits);
+            o.sampleRate    = getCommandLineOption (args, "--sample-rate", o.sampleRate);
+            o.secondsPerRun = getCommandLineOption (args, "--seconds", o.secondsPerRun);
+            o.blockSize     = getCommandLineOption (args, "--block-size", o.blockSize);
+            o.notes         = getCommandLineOption (args, "--notes", o.notes);
+            o.voiceCounts   = getCommandLineOption (args, "--voices", o.voiceCounts);
+            return o;
+        }
+    };
+
+    explicit WavetableBenchmark (Options optionsToUse)  : options (std::move (optionsToUse)) {}
+
+    /** Prints one line per configuration and returns a process exit code. */
+    int run()
+    {
+        PerfCounters counters;
+
+        std::cout << "table_size,note,voices,ns_per_sample,cycles_per_sample,l1d_miss_rate,llc_miss_rate,max_error_db,rms_error_db" << std::endl;
+
+        for (auto bits = options.minTableBits; bits <= options.maxTableBits; ++bits)
+        {
+            MipmappedWavetable table (weights(), 1 << bits);
+            table.prepare (options.sampleRate);
+
+            for (auto note : options.notes)
+            {
+                const auto& level = table.getTableForNote (note);
+                auto error = measureError (level, table, note);
+
+                for (auto numVoices : options.voiceCounts)
+                {
+                    auto result = measureSpeed (level, note, numVoices, counters);
+
+                    std::cout << (1 << bits) << ',' << note << ',' << numVoices << ','
+                              << result.nanosecondsPerSample << ','
+                              << formatCounter (counters, PerfCounters::cycles, result.samplesRendered) << ','
+                              << formatRatio (counters, PerfCounters::l1dMisses, PerfCounters::l1dReads) << ','
+                              << formatRatio (counters, PerfCounters::llcMisses, PerfCounters::llcReads) << ','
+                              << error.maxDb << ',' << error.rmsDb << std::endl;
+                }
+            }
+        }
+
+        return 0;
+    }
+
+private:
+    static constexpr int errorTestPoints = 48000;
+
+    struct SpeedResult
+    {
+        double nanosecondsPerSample;
+        double samplesRendered;
+    };
+
+    struct ErrorResult
+    {
+        double maxDb, rmsDb;
+    };
+
+    static std::vector<float> weights()
+    {
+        std::vector<float> result;
+
+        for (auto harmonic = 1; harmonic <= 8; ++harmonic)
+            result.push_back (1.0f / (float) harmonic);
+
+        return result;
+    }
+
+    /** Voices start at spread-out phases so their table reads don't share cache lines. */
+    SpeedResult measureSpeed (const juce::AudioSampleBuffer& table, int note, int numVoices, PerfCounters& counters)
+    {
+        std::vector<WavetableOscillator> oscillators ((size_t) numVoices);
+        juce::Random random (note * 1000 + numVoices);
+        auto frequency = (float) juce::MidiMessage::getMidiNoteInHertz (note);
+
+        for (auto& osc : oscillators)
+        {
+            osc.setWavetable (table);
+            osc.setFrequency (frequency * (1.0f + 0.01f * random.nextFloat()), (float) options.sampleRate);
+
+            for (auto i = random.nextInt (4096); --i >= 0;)
+                osc.getNextSample();
+        }
+
+        juce::AudioSampleBuffer output (1, options.blockSize);
+        auto numBlocks = juce::jmax (1, (int) (options.secondsPerRun * options.sampleRate) / options.blockSize);
+
+        counters.start();
+        auto startTicks = juce::Time::getHighResolutionTicks();
+
+        for (auto block = 0; block < numBlocks; ++block)
+        {
+            output.clear();
+            auto* samples = output.getWritePointer (0);
+
+            for (auto& osc : oscillators)
+                for (auto i = 0; i < options.blockSize; ++i)
+                    samples[i] += osc.getNextSample();
+        }
+
+        auto elapsed = juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks() - startTicks);
+        counters.stop();
+
+        // keep the optimiser from discarding the render
+        volatile auto sink = output.getSample (0, 0);
+        juce::ignoreUnused (sink);
+
+        auto samplesRendered = (double) numBlocks * options.blockSize * numVoices;
+        return { elapsed * 1.0e9 / samplesRendered, samplesRendered };
+    }
+
+    /** Compares linear interpolation of the table against the exact harmonic sum
+        at random phases. This isolates the table-size error from the drift of the
+        oscillator's float phase accumulator, which is the same for every size.
+    */
+    ErrorResult measureError (const juce::AudioSampleBuffer& table, const MipmappedWavetable& mipmaps, int note)
+    {
+        auto harmonicWeights = weights();
+        auto numHarmonics = (int) harmonicWeights.size();
+
+        // the level actually in use only contains the harmonics below Nyquist
+        for (auto level = 0; &mipmaps.getLevel (level) != &table; ++level)
+            numHarmonics /= 2;
+
+        auto tableSize = table.getNumSamples() - 1;
+        auto* samples = table.getReadPointer (0);
+        juce::Random random (note);
+
+        double peak = 0.0, maxError = 0.0, sumSquaredError = 0.0, sumSquaredSignal = 0.0;
+
+        for (auto i = 0; i < errorTestPoints; ++i)
+        {
+            auto phase = random.nextDouble();
+            auto exact = 0.0;
+
+            for (auto harmonic = 1; harmonic <= numHarmonics; ++harmonic)
+                exact += harmonicWeights[(size_t) harmonic - 1] * std::sin (juce::MathConstants<double>::twoPi * harmonic * phase);
+
+            auto position = phase * tableSize;
+            auto index0 = (int) position;
+            auto frac = (float) (position - index0);
+            auto interpolated = samples[index0] + frac * (samples[index0 + 1] - samples[index0]);
+
+            auto difference = std::abs (interpolated - exact);
+
+            peak = juce::jmax (peak, std::abs (exact));
+            maxError = juce::jmax (maxError, difference);
+            sumSquaredError += difference * difference;
+            sumSquaredSignal += exact * exact;
+        }
+
+        return { juce::Decibels::gainToDecibels (maxError / peak, -200.0),
+                 juce::Decibels::gainToDecibels (std::sqrt (sumSquaredError / sumSquaredSignal), -200.0) };
+    }
+
+    static juce::String formatCounter (const PerfCounters& counters, PerfCounters::Counter counter, double samples)
+    {
+        return counters.isAvailable (counter) ? juce::String ((double) counters.get (counter) / samples, 3) : "n/a";
+    }
+
+    static juce::String formatRatio (const PerfCounters& counters, PerfCounters::Counter misses, PerfCounters::Counter reads)
+    {
+        if (! counters.isAvailable (misses) || ! counters.isAvailable (reads) || counters.get (reads) == 0)
+            return "n/a";
+
+        return juce::String ((double) counters.get (misses) / (double) counters.get (reads), 5);
+    }
+
+    Options options;
+};
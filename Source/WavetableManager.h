@@ -0,0 +1,236 @@
+/*
+  ==============================================================================
+
+    WavetableManager.h
+
+    Keeps the mipmap levels of every registered MipmappedWavetable within a
+    byte budget. A worker thread evicts the least recently used levels that
+    no voice has pinned, and builds levels that notes have asked for once
+    there is room, whether they were evicted or never built. The audio thread
+    never waits for it: a note whose level is missing plays the nearest
+    resident level with fewer harmonics until its own is ready.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "Wavetable.h"
+#include "MemoryUsage.h"
+
+//==============================================================================
+class WavetableManager   : private juce::Thread
+{
+public:
+    /** Until setBudget() is called there is no limit, and no worker thread
+        unless a table is added with levels still to build.
+    */
+    WavetableManager()  : juce::Thread ("Wavetable manager") {}
+
+    ~WavetableManager() override
+    {
+        stopThread (2000);
+    }
+
+    /** Message thread. The table must stay alive until removeTable(). */
+    void addTable (MipmappedWavetable& table)
+    {
+        {
+            const juce::ScopedLock sl (lock);
+            tables.push_back (&table);
+        }
+
+        if (! table.isFullyResident() && ! isThreadRunning())
+            startThread();
+    }
+
+    void removeTable (MipmappedWavetable& table)
+    {
+        const juce::ScopedLock sl (lock);
+        tables.erase (std::remove (tables.begin(), tables.end(), &table), tables.end());
+    }
+
+    /** Bytes of table data to keep resident at most; 0 means no limit. Levels
+        that are pinned, and each table's last level, are kept regardless, so
+        a budget smaller than those is exceeded and reported rather than met.
+        Embedded levels live in the binary rather than the heap and don't count.
+    */
+    void setBudget (size_t bytes)
+    {
+        budget = bytes;
+
+        if (bytes > 0 && ! isThreadRunning())
+            startThread();
+
+        notify();
+    }
+
+    size_t getBudget() const noexcept       { return budget; }
+
+    //==============================================================================
+    /** Levels and resident bytes count heap-built tables only. Rebuilds include
+        the first build of levels left to be built on demand.
+    */
+    struct Residency
+    {
+        size_t residentBytes = 0, budgetBytes = 0, embeddedBytes = 0;
+        int residentLevels = 0, pinnedLevels = 0, totalLevels = 0;
+        juce::int64 evictions = 0, rebuilds = 0;
+
+        juce::String toString() const
+        {
+            return juce::String (residentLevels) + "/" + juce::String (totalLevels) + " levels resident ("
+                    + MemoryUsage::formatBytes (residentBytes) + " of "
+                    + (budgetBytes > 0 ? MemoryUsage::formatBytes (budgetBytes) : juce::String ("unlimited"))
+                    + "), " + MemoryUsage::formatBytes (embeddedBytes) + " embedded, "
+                    + juce::String (pinnedLevels) + " pinned, "
+                    + juce::String (evictions) + " evictions, " + juce::String (rebuilds) + " rebuilds";
+        }
+    };
+
+    /** Any thread but the audio thread. */
+    Residency getResidency() const
+    {
+        const juce::ScopedLock sl (lock);
+
+        Residency r;
+        r.budgetBytes = budget;
+        r.evictions = evictions;
+        r.rebuilds = rebuilds;
+
+        for (auto* table : tables)
+        {
+            for (auto level = 0; level < table->getNumLevels(); ++level)
+            {
+                if (table->isEmbedded (level))
+                {
+                    r.embeddedBytes += table->getLevelBytes();
+                }
+                else
+                {
+                    ++r.totalLevels;
+
+                    if (table->isResident (level))
+                    {
+                        ++r.residentLevels;
+                        r.residentBytes += table->getLevelBytes();
+                    }
+                }
+
+                if (table->isPinned (level))
+                    ++r.pinnedLevels;
+            }
+        }
+
+        return r;
+    }
+
+private:
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            service();
+            wait (pollMilliseconds);
+        }
+    }
+
+    /** Makes room for and builds the levels notes have asked for, then evicts
+        until the budget holds again.
+    */
+    void service()
+    {
+        const juce::ScopedLock sl (lock);
+        auto limit = budget > 0 ? budget.load() : std::numeric_limits<size_t>::max();
+
+        for (auto* table : tables)
+        {
+            for (auto level = 0; level < table->getNumLevels(); ++level)
+            {
+                if (threadShouldExit())
+                    return;
+
+                if (table->isResident (level) || ! table->isWanted (level))
+                    continue;
+
+                if (evictUntil (limit - juce::jmin (limit, table->getLevelBytes())) && table->rebuild (level))
+                    ++rebuilds;
+            }
+        }
+
+        evictUntil (limit);
+    }
+
+    /** Evicts least recently used levels until no more than bytes are resident.
+        Returns false if pinned levels stop it getting there.
+    */
+    bool evictUntil (size_t bytes)
+    {
+        auto resident = getResidentBytes();
+
+        while (resident > bytes)
+        {
+            MipmappedWavetable* oldestTable = nullptr;
+            auto oldestLevel = -1;
+
+            for (auto* table : tables)
+            {
+                for (auto level = 0; level < table->getNumLevels(); ++level)
+                {
+                    if (! table->isEvictable (level) || ! table->isResident (level) || table->isPinned (level))
+                        continue;
+
+                    if (oldestTable == nullptr || isOlder (table->getLastUsed (level), oldestTable->getLastUsed (oldestLevel)))
+                    {
+                        oldestTable = table;
+                        oldestLevel = level;
+                    }
+                }
+            }
+
+            if (oldestTable == nullptr)
+                return false;
+
+            if (oldestTable->evict (oldestLevel))
+            {
+                resident -= oldestTable->getLevelBytes();
+                ++evictions;
+            }
+            else
+            {
+                // pinned between the check and the eviction; look again
+                resident = getResidentBytes();
+            }
+        }
+
+        return true;
+    }
+
+    size_t getResidentBytes() const noexcept
+    {
+        size_t bytes = 0;
+
+        for (auto* table : tables)
+            for (auto level = 0; level < table->getNumLevels(); ++level)
+                if (table->isResident (level) && ! table->isEmbedded (level))
+                    bytes += table->getLevelBytes();
+
+        return bytes;
+    }
+
+    /** Millisecond counters wrap every 49 days. */
+    static bool isOlder (juce::uint32 a, juce::uint32 b) noexcept
+    {
+        return (juce::int32) (a - b) < 0;
+    }
+
+    static constexpr int pollMilliseconds = 20;
+
+    juce::CriticalSection lock;
+    std::vector<MipmappedWavetable*> tables;
+    std::atomic<size_t> budget { 0 };
+    std::atomic<juce::int64> evictions { 0 }, rebuilds { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (WavetableManager)
+};